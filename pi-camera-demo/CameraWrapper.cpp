@@ -3,15 +3,89 @@
 
 #include <spdlog/spdlog.h>
 
+#include <array>
+#include <string>
 #include <utility>
 
-CameraWrapper::CameraWrapper(unsigned int width, unsigned int height)
+#include "Metrics.hpp"
+#include "Resources.hpp"
+
+namespace
+{
+    auto& framesCaptured = metrics::GetRegistry().AddCounter(
+        "camera_frames_captured_total", "Frames completed by the camera");
+    auto& framesDropped = metrics::GetRegistry().AddCounter(
+        "camera_frames_dropped_total", "Sensor frames missing from the completed sequence");
+    auto& framesDuplicated = metrics::GetRegistry().AddCounter(
+        "camera_frames_duplicated_total", "Sensor frames completed twice in a row");
+    auto& framesOutOfOrder = metrics::GetRegistry().AddCounter(
+        "camera_frames_out_of_order_total", "Sensor frames completed after a later one");
+    auto& framesRepeated = metrics::GetRegistry().AddCounter(
+        "camera_frames_repeated_total", "Extra refreshes for which the display showed a frame again");
+    auto& requestsQueued = metrics::GetRegistry().AddGauge(
+        "camera_requests_queued", "Requests queued to the camera and not yet completed");
+    auto& queueRequestDuration = metrics::GetRegistry().AddHistogram(
+        "camera_queue_request_duration_seconds", "Time spent in Camera::queueRequest", metrics::CallDurationBounds());
+
+    // The jitter histogram only covers FrameMonitor's rolling window, which a Prometheus
+    // histogram, being cumulative, can't express; so one gauge per bin instead.
+    std::array<metrics::Gauge*, FrameMonitor::JITTER_BIN_COUNT> jitterWindowGauges()
+    {
+        std::array<metrics::Gauge*, FrameMonitor::JITTER_BIN_COUNT> gauges;
+        const auto& bounds = FrameMonitor::JITTER_BIN_BOUNDS_US;
+        for (size_t bin = 0; bin < gauges.size(); bin++)
+        {
+            const auto lower = bin == 0 ? std::string("0") : std::to_string(bounds[bin - 1]);
+            const auto range = bin < bounds.size() ? lower + "_to_" + std::to_string(bounds[bin]) : "over_" + lower;
+            gauges[bin] = &metrics::GetRegistry().AddGauge(
+                "camera_frame_jitter_window_" + range + "us",
+                "Frame intervals in the rolling jitter window with absolute jitter of " + range + "us");
+        }
+        return gauges;
+    }
+
+    const auto jitterWindow = jitterWindowGauges();
+}
+
+CameraWrapper::CameraWrapper(const SourceConfig& config)
 {
-    m_width = width;
-    m_height = height;
+    m_config = config;
     m_cameraManager = std::make_unique<libcamera::CameraManager>();
 }
 
+CameraWrapper::~CameraWrapper()
+{
+    StopCapture();
+
+    // Requests refer to the buffers, so they go first.
+    m_requests.clear();
+    for (const auto& [buffer, planes] : m_cameraMappedBuffers)
+    {
+        for (const auto& plane : planes)
+        {
+            munmap(const_cast<uint8_t*>(plane.data()), plane.size());
+            resources::cameraMappings.Add(-1);
+            resources::cameraMappedBytes.Add(-static_cast<int64_t>(plane.size()));
+        }
+    }
+    m_cameraMappedBuffers.clear();
+    m_videoFrameBuffers = {};
+
+    if (m_cameraFrameBuffersAllocator)
+    {
+        resources::cameraBuffers.Add(-static_cast<int64_t>(m_cameraFrameBuffersAllocator->buffers(m_videoStream).size()));
+        m_cameraFrameBuffersAllocator->free(m_videoStream);
+        m_cameraFrameBuffersAllocator.reset();
+    }
+    if (m_camera)
+    {
+        m_camera->release();
+        m_camera.reset();
+    }
+    m_cameraManager->stop();
+    spdlog::info("Camera released");
+}
+
 void CameraWrapper::Init(std::function<void(CameraWrapper*, libcamera::Request*)> processRequest)
 {
     m_processRequest = std::move(processRequest);
@@ -29,10 +103,20 @@ void CameraWrapper::StartCapture()
 {
     if (!m_controls.contains(libcamera::controls::FrameDurationLimits))
     {
-
-            int64_t frame_time = 1000000 / 60; // in us
+            int64_t frame_time = m_pacingControl
+                ? m_framePacer.FrameDurationUs()
+                : static_cast<int64_t>(1000000 / m_config.framerate); // in us
             m_controls.set(libcamera::controls::FrameDurationLimits, { frame_time, frame_time });
     }
+    const auto frameDurationLimits = m_controls.get(libcamera::controls::FrameDurationLimits);
+    m_requestedFrameDurationUs = (*frameDurationLimits)[0];
+    m_frameMonitor.SetFrameDuration(m_requestedFrameDurationUs);
+    // Sequence numbers start again from zero and the sensor's phase is new, so nothing
+    // from a previous run carries over.
+    m_frameMonitor.Reset();
+    m_framePacer.Reset();
+    m_zoomController.Reset();
+    m_lastSequence = 0;
 
 
     if (m_camera->start(&m_controls))
@@ -43,16 +127,41 @@ void CameraWrapper::StartCapture()
 
     m_camera->requestCompleted.connect(this, &CameraWrapper::requestComplete);
 
-    for (auto& request : m_requests)
+    std::lock_guard lock(m_runningMutex);
+    m_running = true;
+    for (auto request : m_idleRequests)
     {
-        if (m_camera->queueRequest(request.get()) < 0)
+        // Requests that completed or were cancelled in an earlier run keep their status
+        // and controls until reused, and libcamera refuses to queue them otherwise.
+        request->reuse(libcamera::Request::ReuseFlag::ReuseBuffers);
+        m_zoomController.OnQueue(request, m_lastSequence);
+        queueRequest(request);
+    }
+    m_idleRequests.clear();
+}
+
+void CameraWrapper::StopCapture()
+{
+    {
+        std::lock_guard lock(m_runningMutex);
+        if (!m_running)
         {
-            throw std::runtime_error("Failed to queue request");
+            return;
         }
+        m_running = false;
+    }
+
+    // Not under the lock: stop() waits for requests completing on the camera thread,
+    // whose frames may be given back (and so take the lock) along the way.
+    if (m_camera->stop())
+    {
+        spdlog::error("Failed to stop camera");
     }
+    m_camera->requestCompleted.disconnect(this, &CameraWrapper::requestComplete);
+    spdlog::info("Camera stopped");
 }
 
-std::vector<libcamera::Span<uint8_t>> CameraWrapper::Mmap(libcamera::FrameBuffer* buffer)
+std::vector<libcamera::Span<const uint8_t>> CameraWrapper::Mmap(libcamera::FrameBuffer* buffer)
 {
     auto item = m_cameraMappedBuffers.find(buffer);
     if (item == m_cameraMappedBuffers.end())
@@ -74,16 +183,80 @@ libcamera::Stream* CameraWrapper::GetVideoStream()
 
 void CameraWrapper::ReuseRequest(libcamera::Request * request)
 {
+    std::lock_guard lock(m_runningMutex);
+    if (!m_running)
+    {
+        m_idleRequests.push_back(request);
+        return;
+    }
     request->reuse(libcamera::Request::ReuseFlag::ReuseBuffers);
-    if (m_camera->queueRequest(request) < 0)
+    m_zoomController.OnQueue(request, m_lastSequence);
+    applyFrameDuration(request);
+    queueRequest(request);
+}
+
+FrameMonitor::Stats CameraWrapper::GetFrameStats() const
+{
+    return m_frameMonitor.GetStats();
+}
+
+void CameraWrapper::SetZoom(double factor, double centreX, double centreY, unsigned int rampFrames)
+{
+    m_zoomController.SetZoom(factor, centreX, centreY, rampFrames);
+}
+
+void CameraWrapper::SetRegionOfInterest(const libcamera::Rectangle& roi, unsigned int rampFrames)
+{
+    m_zoomController.SetRegionOfInterest(roi, rampFrames);
+}
+
+ZoomController::Stats CameraWrapper::GetZoomStats() const
+{
+    return m_zoomController.GetStats();
+}
+
+libcamera::Rectangle CameraWrapper::GetDisplayCrop(libcamera::Request* request) const
+{
+    return m_zoomController.GetDisplayCrop(request);
+}
+
+void CameraWrapper::EnablePacing(double refreshHz, bool control)
+{
+    // The fastest the sensor can go in the configured mode.
+    int64_t minFrameDurationUs = 0;
+    const auto frameDurationLimits = m_camera->controls().find(&libcamera::controls::FrameDurationLimits);
+    if (frameDurationLimits != m_camera->controls().end())
     {
-        throw std::runtime_error("Failed to queue request");
+        minFrameDurationUs = frameDurationLimits->second.min().get<int64_t>();
+    }
+
+    const auto frameDurationUs = m_framePacer.Configure(refreshHz, m_config.framerate, minFrameDurationUs, control);
+    m_pacingControl = control;
+    if (control)
+    {
+        spdlog::info("Display refresh {:.3f} Hz, camera frame duration {} us", refreshHz, frameDurationUs);
     }
 }
 
+void CameraWrapper::OnFrameDisplayed(int64_t arrivalNs, uint64_t latchSequence, int64_t latchNs)
+{
+    m_framePacer.OnDisplayed(arrivalNs, latchSequence, latchNs);
+    framesRepeated.Increment(m_frameMonitor.OnDisplayed(latchSequence, m_framePacer.GetStats().refreshesPerFrame));
+}
+
+FramePacer::Stats CameraWrapper::GetPacingStats() const
+{
+    return m_framePacer.GetStats();
+}
+
 void CameraWrapper::initCamera()
 {
-    const auto cameraId = m_cameraManager->cameras()[0]->id();
+    const auto cameras = m_cameraManager->cameras();
+    if (m_config.camera >= cameras.size())
+    {
+        throw std::runtime_error("camera " + std::to_string(m_config.camera) + " not found");
+    }
+    const auto cameraId = cameras[m_config.camera]->id();
     m_camera = m_cameraManager->get(cameraId);
     m_camera->acquire();
 }
@@ -94,11 +267,11 @@ void CameraWrapper::initVideoStream()
     m_cameraConfiguration = m_camera->generateConfiguration(streamRoles);
 
     auto& streamConfiguration = m_cameraConfiguration->at(0);
-    streamConfiguration.pixelFormat = libcamera::formats::YUV420;
-    streamConfiguration.bufferCount = BufferCount; // 6 buffers is better than 4
-    streamConfiguration.size.width = m_width;
-    streamConfiguration.size.height = m_height;
-    streamConfiguration.colorSpace = libcamera::ColorSpace::Rec709;
+    streamConfiguration.pixelFormat = m_config.pixelFormat;
+    streamConfiguration.bufferCount = m_config.bufferCount;
+    streamConfiguration.size.width = m_config.width;
+    streamConfiguration.size.height = m_config.height;
+    streamConfiguration.colorSpace = m_config.colourSpace;
 }
 
 void CameraWrapper::initCapture()
@@ -118,9 +291,22 @@ void CameraWrapper::initCapture()
         throw std::runtime_error("failed to configure streams");
     }
 
+    // The crop limits depend on the sensor mode picked by configure().
+    const auto scalerCrop = m_camera->controls().find(&libcamera::controls::ScalerCrop);
+    if (scalerCrop != m_camera->controls().end())
+    {
+        m_zoomController.Configure(
+            scalerCrop->second.max().get<libcamera::Rectangle>(),
+            m_cameraConfiguration->at(0).size);
+    }
+    else
+    {
+        spdlog::warn("ScalerCrop is not supported, zoom disabled");
+    }
+
     // Next allocate all the buffers we need, mmap them and store them on a free list.
 
-    m_cameraFrameBuffersAllocator = new libcamera::FrameBufferAllocator(m_camera);
+    m_cameraFrameBuffersAllocator = std::make_unique<libcamera::FrameBufferAllocator>(m_camera);
 
     // There is only one stream in our application
     m_videoStream = m_cameraConfiguration->at(0).stream();
@@ -129,11 +315,14 @@ void CameraWrapper::initCapture()
     {
         throw std::runtime_error("failed to allocate capture buffers");
     }
+    resources::cameraBuffers.Add(static_cast<int64_t>(m_cameraFrameBuffersAllocator->buffers(m_videoStream).size()));
 
     for (const auto& buffer : m_cameraFrameBuffersAllocator->buffers(m_videoStream))
     {
         // "Single plane" buffers appear as multi-plane here, but we can spot them because then
         // planes all share the same fd. We accumulate them so as to mmap the buffer only once.
+        // Nothing on the CPU writes to capture buffers, so the mappings are read-only; readers
+        // bracket their accesses with CpuAccess.
         size_t buffer_size = 0;
         for (unsigned i = 0; i < buffer->planes().size(); i++)
         {
@@ -141,9 +330,15 @@ void CameraWrapper::initCapture()
             buffer_size += plane.length;
             if (i == buffer->planes().size() - 1 || plane.fd.get() != buffer->planes()[i + 1].fd.get())
             {
-                auto memory = mmap(nullptr, buffer_size, PROT_READ | PROT_WRITE, MAP_SHARED, plane.fd.get(), 0);
+                auto memory = mmap(nullptr, buffer_size, PROT_READ, MAP_SHARED, plane.fd.get(), 0);
+                if (memory == MAP_FAILED)
+                {
+                    throw std::runtime_error("failed to mmap capture buffer");
+                }
+                resources::cameraMappings.Add(1);
+                resources::cameraMappedBytes.Add(static_cast<int64_t>(buffer_size));
                 m_cameraMappedBuffers[buffer.get()].push_back(
-                    libcamera::Span<uint8_t>(static_cast<uint8_t*>(memory), buffer_size));
+                    libcamera::Span<const uint8_t>(static_cast<const uint8_t*>(memory), buffer_size));
                 buffer_size = 0;
             }
         }
@@ -173,23 +368,90 @@ void CameraWrapper::initRequests()
             throw std::runtime_error("failed to add buffer to request");
         }
 
+        m_idleRequests.push_back(request.get());
         m_requests.push_back(std::move(request));
     }
 
     spdlog::info("Requests created");
 }
 
+void CameraWrapper::queueRequest(libcamera::Request* request)
+{
+    metrics::ScopedTimer timer(queueRequestDuration);
+    if (m_camera->queueRequest(request) < 0)
+    {
+        throw std::runtime_error("Failed to queue request");
+    }
+    requestsQueued.Add(1);
+}
+
+void CameraWrapper::applyFrameDuration(libcamera::Request* request)
+{
+    if (!m_pacingControl)
+    {
+        return;
+    }
+
+    // Only requests that change the duration carry the control; the sensor keeps the
+    // last one otherwise.
+    const int64_t frameDurationUs = m_framePacer.FrameDurationUs();
+    if (m_requestedFrameDurationUs.exchange(frameDurationUs) != frameDurationUs)
+    {
+        request->controls().set(libcamera::controls::FrameDurationLimits, { frameDurationUs, frameDurationUs });
+    }
+}
+
 void CameraWrapper::requestComplete(libcamera::Request* request)
 {
-    spdlog::info("Requests completed");
+    requestsQueued.Add(-1);
     if (request->status() == libcamera::Request::RequestCancelled)
     {
+        std::lock_guard lock(m_runningMutex);
+        m_idleRequests.push_back(request);
         return;
     }
 
+    tagFrame(request);
     m_processRequest(this, request);
 }
 
+void CameraWrapper::tagFrame(libcamera::Request* request)
+{
+    // Prefer the sensor's own sequence and timestamp; fall back to the values the
+    // capture buffer was dequeued with when the pipeline handler doesn't report them.
+    const auto buffer = request->buffers().at(m_videoStream);
+    const auto& bufferMetadata = buffer->metadata();
+    const auto& metadata = request->metadata();
+
+    const auto sequence = metadata.get(libcamera::controls::SensorSequence);
+    const auto timestamp = metadata.get(libcamera::controls::SensorTimestamp);
+    // While pacing moves the duration frame by frame, jitter has to be measured against
+    // what each frame was actually given, not the nominal duration. Without the sensor's
+    // report the last duration asked for is the closest there is.
+    const auto frameDuration = metadata.get(libcamera::controls::FrameDuration);
+    const int64_t frameDurationUs = frameDuration ? *frameDuration
+        : m_pacingControl                           ? m_requestedFrameDurationUs.load()
+                                                    : 0;
+
+    m_lastSequence = sequence ? static_cast<uint32_t>(*sequence) : bufferMetadata.sequence;
+    framesCaptured.Increment();
+    const auto result = m_frameMonitor.OnFrame(
+        m_lastSequence,
+        timestamp ? *timestamp : static_cast<int64_t>(bufferMetadata.timestamp),
+        frameDurationUs);
+    framesDropped.Increment(result.dropped);
+    framesDuplicated.Increment(result.duplicated ? 1 : 0);
+    framesOutOfOrder.Increment(result.outOfOrder ? 1 : 0);
+    const auto histogram = m_frameMonitor.GetStats().jitterHistogram;
+    for (size_t bin = 0; bin < histogram.size(); bin++)
+    {
+        jitterWindow[bin]->Set(static_cast<int64_t>(histogram[bin]));
+    }
+    m_zoomController.OnComplete(request, m_lastSequence);
+
+    spdlog::debug("Request completed: sequence {}", m_lastSequence.load());
+}
+
 StreamInfo CameraWrapper::getStreamInfo(libcamera::Stream const* stream)
 {
     auto const& cfg = stream->configuration();
@@ -1,45 +1,87 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <queue>
 #include <libcamera/libcamera.h>
 
+#include "FrameMonitor.hpp"
+#include "FramePacer.hpp"
+#include "PipelineConfig.hpp"
+#include "ZoomController.hpp"
 #include "stream_info.hpp"
 
 class CameraWrapper
 {
 private:
-    const unsigned int BufferCount = 6;
-
-private:
-    unsigned int m_width;
-    unsigned int m_height;
+    SourceConfig m_config;
 
     std::unique_ptr<libcamera::CameraManager> m_cameraManager = nullptr;
     std::shared_ptr<libcamera::Camera> m_camera = nullptr;
     std::unique_ptr<libcamera::CameraConfiguration> m_cameraConfiguration = nullptr;
-    libcamera::FrameBufferAllocator* m_cameraFrameBuffersAllocator = nullptr;
-    std::map<libcamera::FrameBuffer*, std::vector<libcamera::Span<uint8_t>>> m_cameraMappedBuffers;
+    std::unique_ptr<libcamera::FrameBufferAllocator> m_cameraFrameBuffersAllocator = nullptr;
+    std::map<libcamera::FrameBuffer*, std::vector<libcamera::Span<const uint8_t>>> m_cameraMappedBuffers;
     std::queue<libcamera::FrameBuffer*> m_videoFrameBuffers;
     std::vector<std::unique_ptr<libcamera::Request>> m_requests;
     libcamera::Stream* m_videoStream = nullptr;
     libcamera::ControlList m_controls = libcamera::controls::controls;
     std::function<void(CameraWrapper* cameraWrapper, libcamera::Request* request)> m_processRequest;
+    FrameMonitor m_frameMonitor;
+    ZoomController m_zoomController;
+    std::atomic<uint32_t> m_lastSequence = 0;
+    FramePacer m_framePacer;
+    bool m_pacingControl = false;
+    std::atomic<int64_t> m_requestedFrameDurationUs = 0;
+    // Guards against requests being queued once the camera is stopping.
+    std::mutex m_runningMutex;
+    bool m_running = false;
+    // Requests neither queued to the camera nor held by the pipeline, which the next
+    // StartCapture queues; the rest come back through ReuseRequest while running.
+    std::vector<libcamera::Request*> m_idleRequests;
 
 public:
-    CameraWrapper(unsigned int width, unsigned int height);
+    explicit CameraWrapper(const SourceConfig& config);
+    // Stops capture if still running, then unmaps and frees the buffers and releases the
+    // camera. Every request handed out must have been given back by then.
+    ~CameraWrapper();
+    CameraWrapper(const CameraWrapper&) = delete;
+    CameraWrapper& operator=(const CameraWrapper&) = delete;
     void Init(std::function<void(CameraWrapper* cameraWrapper, libcamera::Request* request)> processRequest);
+    // Starts the camera and queues every idle request. May be called again after
+    // StopCapture; zoom, pacing and frame statistics then start afresh.
     void StartCapture();
-    std::vector<libcamera::Span<uint8_t>> Mmap(libcamera::FrameBuffer* buffer);
+    // Stops the camera; requests still queued come back cancelled and are not passed on.
+    // Requests given back afterwards through ReuseRequest are left idle until the next
+    // StartCapture.
+    void StopCapture();
+    std::vector<libcamera::Span<const uint8_t>> Mmap(libcamera::FrameBuffer* buffer);
     StreamInfo GetStreamInfo();
     libcamera::Stream* GetVideoStream();
     void ReuseRequest(libcamera::Request* request);
+    FrameMonitor::Stats GetFrameStats() const;
+    // Digital zoom on the ISP, see ZoomController. Changes take effect on the frames of
+    // subsequently queued requests, one ramp step per frame.
+    void SetZoom(double factor, double centreX = 0.5, double centreY = 0.5, unsigned int rampFrames = 0);
+    void SetRegionOfInterest(const libcamera::Rectangle& roi, unsigned int rampFrames = 0);
+    ZoomController::Stats GetZoomStats() const;
+    libcamera::Rectangle GetDisplayCrop(libcamera::Request* request) const;
+    // Pace the sensor to a display refreshing at `refreshHz`, see FramePacer. With
+    // `control` false the pacing is only measured. Must be called before StartCapture.
+    void EnablePacing(double refreshHz, bool control);
+    // A frame reached the display at `arrivalNs` and was latched by vblank
+    // `latchSequence` at `latchNs`, see FramePacer::OnDisplayed.
+    void OnFrameDisplayed(int64_t arrivalNs, uint64_t latchSequence, int64_t latchNs);
+    FramePacer::Stats GetPacingStats() const;
 
 private:
     void initCamera();
     void initVideoStream();
     void initCapture();
     void initRequests();
+    void queueRequest(libcamera::Request* request);
+    void applyFrameDuration(libcamera::Request* request);
     void requestComplete(libcamera::Request* request);
+    void tagFrame(libcamera::Request* request);
     static StreamInfo getStreamInfo(libcamera::Stream const* stream);
 };
@@ -0,0 +1,87 @@
+#include "CpuAccess.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <linux/dma-buf.h>
+#include <sys/ioctl.h>
+
+#include <spdlog/spdlog.h>
+
+#define ERRSTR strerror(errno)
+
+namespace
+{
+    constexpr size_t CACHE_LINE = 64;
+    // Far enough ahead to cover the memory latency at streaming rates, near enough not to
+    // be evicted again before it's used.
+    constexpr size_t PREFETCH_DISTANCE = 8 * CACHE_LINE;
+    constexpr size_t COPY_CHUNK = 4 * CACHE_LINE;
+}
+
+CpuAccess::CpuAccess(const Frame& frame)
+{
+    if (!frame.buffer)
+    {
+        return;
+    }
+    for (const auto& plane : frame.buffer->planes())
+    {
+        const auto fd = plane.fd.get();
+        if (std::find(m_fds.begin(), m_fds.end(), fd) == m_fds.end())
+        {
+            m_fds.push_back(fd);
+        }
+    }
+    for (const auto fd : m_fds)
+    {
+        sync(fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+    }
+}
+
+CpuAccess::~CpuAccess()
+{
+    for (const auto fd : m_fds)
+    {
+        sync(fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+    }
+}
+
+void CpuAccess::sync(int fd, uint64_t flags)
+{
+    dma_buf_sync sync = {};
+    sync.flags = flags;
+    int result;
+    do
+    {
+        result = ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+    } while (result < 0 && (errno == EINTR || errno == EAGAIN));
+
+    // Reading carries on regardless, so say so once rather than for every frame.
+    static std::atomic<bool> warned = false;
+    if (result < 0 && !warned.exchange(true))
+    {
+        spdlog::warn("DMA_BUF_IOCTL_SYNC failed, CPU reads may see stale data: {}", ERRSTR);
+    }
+}
+
+void StreamRows(const uint8_t* source, size_t stride, size_t rowBytes, size_t rowCount, uint8_t* destination)
+{
+    for (size_t row = 0; row < rowCount; row++)
+    {
+        const auto rowStart = source + row * stride;
+        for (size_t offset = 0; offset < rowBytes; offset += COPY_CHUNK)
+        {
+            // Past the end of this row the stream carries on at the start of the next one.
+            // Prefetches never fault, so running off the last row is harmless.
+            for (size_t line = 0; line < COPY_CHUNK; line += CACHE_LINE)
+            {
+                const auto ahead = offset + line + PREFETCH_DISTANCE;
+                __builtin_prefetch(ahead < rowBytes ? rowStart + ahead : rowStart + stride + (ahead - rowBytes), 0, 0);
+            }
+            std::memcpy(destination + offset, rowStart + offset, std::min(COPY_CHUNK, rowBytes - offset));
+        }
+        destination += rowBytes;
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Pipeline.hpp"
+
+// Brackets CPU reads of a frame's dmabufs with DMA_BUF_IOCTL_SYNC, so that a cached
+// mapping sees what the ISP wrote rather than stale cache lines, and so that the kernel
+// knows the CPU is done when the scope ends. Frames that aren't backed by dmabufs (from
+// a fake source) need nothing and pass straight through.
+class CpuAccess
+{
+private:
+    std::vector<int> m_fds;
+
+public:
+    explicit CpuAccess(const Frame& frame);
+    ~CpuAccess();
+    CpuAccess(const CpuAccess&) = delete;
+    CpuAccess& operator=(const CpuAccess&) = delete;
+
+private:
+    static void sync(int fd, uint64_t flags);
+};
+
+// Copies `rowCount` rows of `rowBytes` each, `stride` apart at `source`, packed into
+// `destination`. Loads are prefetched ahead with a streaming (non-temporal) hint, so a
+// reader that only needs part of an uncached or write-combined buffer pays for one
+// sequential pass over just those rows and then works on cached memory.
+void StreamRows(const uint8_t* source, size_t stride, size_t rowBytes, size_t rowCount, uint8_t* destination);
@@ -0,0 +1,104 @@
+#include "CpuReadSink.hpp"
+
+#include <chrono>
+
+#include <spdlog/spdlog.h>
+
+#include "CpuAccess.hpp"
+
+CpuReadSink::CpuReadSink(const NodeConfig& config) : m_config(config)
+{
+    auto& registry = metrics::GetRegistry();
+    for (const auto& name : m_config.cpuReadModes)
+    {
+        Mode mode;
+        mode.name = name;
+        const auto prefix = "cpu_read_" + m_config.name + "_" + name;
+        mode.duration = &registry.AddHistogram(
+            prefix + "_duration_seconds", "Time node " + m_config.name + " took to read a frame " + name,
+            metrics::CallDurationBounds());
+        mode.bandwidth = &registry.AddGauge(
+            prefix + "_bytes_per_second", "Average rate node " + m_config.name + " read frames at " + name);
+        m_modes.push_back(mode);
+    }
+}
+
+CpuReadSink::~CpuReadSink()
+{
+    for (const auto& mode : m_modes)
+    {
+        if (mode.frames == 0)
+        {
+            continue;
+        }
+        spdlog::info(
+            "CPU read {} {}: {} frames, {} bytes each, {:.0f}us per frame, {:.1f} MB/s",
+            m_config.name,
+            mode.name,
+            mode.frames,
+            mode.bytes / mode.frames,
+            mode.durationNs / 1e3 / mode.frames,
+            mode.bytes * 1e3 / mode.durationNs);
+    }
+    spdlog::debug("CPU read {} checksum {}", m_config.name, m_checksum);
+}
+
+void CpuReadSink::Consume(FramePtr frame)
+{
+    const auto& info = frame->info;
+    const auto full = libcamera::Rectangle(0, 0, info.width, info.height);
+    const auto region = m_config.region.isNull() ? full : m_config.region.boundedTo(full);
+    const auto source = frame->planes[0].data() + static_cast<size_t>(region.y) * info.stride + region.x;
+    const size_t bytes = static_cast<size_t>(region.width) * region.height;
+
+    auto& mode = m_modes[m_nextMode];
+    m_nextMode = (m_nextMode + 1) % m_modes.size();
+
+    const auto start = std::chrono::steady_clock::now();
+    if (mode.name == "direct")
+    {
+        m_checksum += sum(source, info.stride, region.width, region.height);
+    }
+    else if (mode.name == "synced")
+    {
+        CpuAccess access(*frame);
+        m_checksum += sum(source, info.stride, region.width, region.height);
+    }
+    else
+    {
+        m_scratch.resize(bytes);
+        {
+            CpuAccess access(*frame);
+            StreamRows(source, info.stride, region.width, region.height, m_scratch.data());
+        }
+        m_checksum += sum(m_scratch.data(), region.width, region.width, region.height);
+    }
+    const auto elapsedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+
+    mode.frames++;
+    mode.bytes += bytes;
+    mode.durationNs += elapsedNs;
+    mode.duration->Observe(elapsedNs);
+    if (mode.durationNs > 0)
+    {
+        mode.bandwidth->Set(static_cast<int64_t>(mode.bytes * 1e9 / mode.durationNs));
+    }
+}
+
+uint64_t CpuReadSink::sum(const uint8_t* data, size_t stride, size_t rowBytes, size_t rowCount)
+{
+    uint64_t total = 0;
+    for (size_t row = 0; row < rowCount; row++)
+    {
+        // A row of bytes can't overflow 32 bits, which lets the compiler vectorise this.
+        uint32_t rowTotal = 0;
+        const auto rowStart = data + row * stride;
+        for (size_t x = 0; x < rowBytes; x++)
+        {
+            rowTotal += rowStart[x];
+        }
+        total += rowTotal;
+    }
+    return total;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Pipeline.hpp"
+
+// Pipeline node standing in for a CPU consumer of frames, such as an analyser, that reads
+// a region of the luma plane. It takes turns, frame by frame, between ways of reading
+// the buffer and measures each one's read bandwidth under the same conditions:
+//   direct: straight from the mapping, with no cache maintenance.
+//   synced: the same inside a CpuAccess scope.
+//   staged: inside a CpuAccess scope, StreamRows copies the region into cached scratch
+//           memory, which is then read from there.
+// Results go to metrics as they come, and to the log when the node is destroyed.
+class CpuReadSink : public FrameSink
+{
+private:
+    struct Mode
+    {
+        std::string name;
+        metrics::Histogram* duration;
+        metrics::Gauge* bandwidth;
+        uint64_t frames = 0;
+        uint64_t bytes = 0;
+        int64_t durationNs = 0;
+    };
+
+    NodeConfig m_config;
+    std::vector<Mode> m_modes;
+    size_t m_nextMode = 0;
+    std::vector<uint8_t> m_scratch;
+    // Keeps the reads from being optimised away.
+    uint64_t m_checksum = 0;
+
+public:
+    explicit CpuReadSink(const NodeConfig& config);
+    ~CpuReadSink() override;
+    void Consume(FramePtr frame) override;
+
+private:
+    static uint64_t sum(const uint8_t* data, size_t stride, size_t rowBytes, size_t rowCount);
+};
@@ -0,0 +1,13 @@
+#include "DecimateStage.hpp"
+
+DecimateStage::DecimateStage(const NodeConfig& config) : m_every(config.every)
+{
+}
+
+void DecimateStage::Consume(FramePtr frame)
+{
+    if (m_frames++ % m_every == 0)
+    {
+        forward(std::move(frame));
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Pipeline.hpp"
+
+// Pipeline stage passing on one frame in every `every`, so that a sink with no need for
+// the full frame rate, such as an analyser, gets fewer frames rather than dropping
+// whichever happen to arrive while it is busy.
+class DecimateStage : public FrameStage
+{
+private:
+    const unsigned int m_every;
+    uint64_t m_frames = 0;
+
+public:
+    explicit DecimateStage(const NodeConfig& config);
+    void Consume(FramePtr frame) override;
+};
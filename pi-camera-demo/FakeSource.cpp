@@ -0,0 +1,111 @@
+#include "FakeSource.hpp"
+
+#include <chrono>
+#include <cstring>
+
+#include <spdlog/spdlog.h>
+
+#include "Resources.hpp"
+
+namespace
+{
+    auto& fakeFramesDropped = metrics::GetRegistry().AddCounter(
+        "fake_source_frames_dropped_total", "Fake source frames skipped because every buffer was in use");
+}
+
+FakeSource::FakeSource(const SourceConfig& config, FrameCallback callback)
+    : m_config(config), m_callback(std::move(callback))
+{
+    m_info.width = m_config.width;
+    m_info.height = m_config.height;
+    m_info.stride = m_config.width;
+    m_info.pixel_format = libcamera::formats::YUV420;
+    m_info.colour_space = m_config.colourSpace;
+    m_frameSize = m_info.stride * m_info.height * 3 / 2;
+
+    for (unsigned int i = 0; i < m_config.bufferCount; i++)
+    {
+        m_buffers.emplace_back(new uint8_t[m_frameSize]);
+        m_freeBuffers.push_back(m_buffers.back().get());
+    }
+    resources::fakeBuffers.Add(static_cast<int64_t>(m_buffers.size()));
+    resources::fakeBufferBytes.Add(static_cast<int64_t>(m_buffers.size() * m_frameSize));
+}
+
+FakeSource::~FakeSource()
+{
+    Stop();
+    resources::fakeBuffers.Add(-static_cast<int64_t>(m_buffers.size()));
+    resources::fakeBufferBytes.Add(-static_cast<int64_t>(m_buffers.size() * m_frameSize));
+}
+
+void FakeSource::Start()
+{
+    spdlog::info("Starting fake source: {}x{} at {} fps", m_info.width, m_info.height, m_config.framerate);
+    m_stop = false;
+    m_thread = std::thread(&FakeSource::run, this);
+}
+
+void FakeSource::Stop()
+{
+    m_stop = true;
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+}
+
+void FakeSource::run()
+{
+    const auto interval = std::chrono::nanoseconds(static_cast<int64_t>(1e9 / m_config.framerate));
+    auto next = std::chrono::steady_clock::now();
+    for (uint64_t sequence = 0; !m_stop; sequence++)
+    {
+        std::this_thread::sleep_until(next);
+        const auto timestamp = next;
+        next += interval;
+
+        uint8_t* buffer;
+        {
+            std::lock_guard lock(m_mutex);
+            if (m_freeBuffers.empty())
+            {
+                fakeFramesDropped.Increment();
+                continue;
+            }
+            buffer = m_freeBuffers.back();
+            m_freeBuffers.pop_back();
+        }
+        fill(buffer, sequence);
+
+        auto frame = std::shared_ptr<Frame>(new Frame(), [this, buffer](Frame* frame) {
+            {
+                std::lock_guard lock(m_mutex);
+                m_freeBuffers.push_back(buffer);
+            }
+            delete frame;
+        });
+        frame->request = nullptr;
+        frame->buffer = nullptr;
+        const auto lumaSize = m_info.stride * m_info.height;
+        frame->planes = {
+            { buffer, lumaSize },
+            { buffer + lumaSize, lumaSize / 4 },
+            { buffer + lumaSize * 5 / 4, lumaSize / 4 },
+        };
+        frame->info = m_info;
+        frame->timestampNs = std::chrono::duration_cast<std::chrono::nanoseconds>(timestamp.time_since_epoch()).count();
+        m_callback(std::move(frame));
+    }
+}
+
+void FakeSource::fill(uint8_t* buffer, uint64_t sequence)
+{
+    // Horizontal bands of luma scrolling down by two lines a frame, on neutral chroma.
+    for (unsigned int y = 0; y < m_info.height; y++)
+    {
+        std::memset(buffer + y * m_info.stride, static_cast<uint8_t>(y + 2 * sequence), m_info.width);
+    }
+    const auto lumaSize = m_info.stride * m_info.height;
+    std::memset(buffer + lumaSize, 128, lumaSize / 2);
+}
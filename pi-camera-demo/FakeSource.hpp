@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Pipeline.hpp"
+#include "PipelineConfig.hpp"
+
+// Stands in for the camera when the source is configured as fake: generates YUV420
+// frames of a moving test pattern at the configured size and frame rate from a pool of
+// `bufferCount` buffers, so pipelines can run without a sensor. Like the camera, it
+// drops a frame when every buffer is still in use downstream. The buffers are ordinary
+// memory, not dmabufs, so they can't be shown by drm_preview. Frames must all have
+// been released before the source is destroyed.
+class FakeSource
+{
+private:
+    using FrameCallback = std::function<void(FramePtr frame)>;
+
+    SourceConfig m_config;
+    FrameCallback m_callback;
+    StreamInfo m_info;
+    size_t m_frameSize;
+    std::vector<std::unique_ptr<uint8_t[]>> m_buffers;
+
+    std::mutex m_mutex;
+    std::vector<uint8_t*> m_freeBuffers;
+    std::atomic<bool> m_stop = false;
+    std::thread m_thread;
+
+public:
+    FakeSource(const SourceConfig& config, FrameCallback callback);
+    ~FakeSource();
+    FakeSource(const FakeSource&) = delete;
+    FakeSource& operator=(const FakeSource&) = delete;
+
+    void Start();
+    void Stop();
+
+private:
+    void run();
+    void fill(uint8_t* buffer, uint64_t sequence);
+};
@@ -0,0 +1,132 @@
+#include "FrameMonitor.hpp"
+
+#include <cstdlib>
+
+FrameMonitor::FrameMonitor(size_t window)
+{
+    m_window.resize(window > 0 ? window : 1);
+}
+
+void FrameMonitor::SetFrameDuration(int64_t frameDurationUs)
+{
+    std::lock_guard lock(m_mutex);
+    m_stats.frameDurationUs = frameDurationUs;
+}
+
+FrameMonitor::Result FrameMonitor::OnFrame(uint32_t sequence, int64_t timestampNs, int64_t frameDurationUs)
+{
+    std::lock_guard lock(m_mutex);
+    m_stats.frames++;
+    Result result;
+
+    if (!m_hasLast)
+    {
+        m_hasLast = true;
+        m_lastSequence = sequence;
+        m_lastTimestampNs = timestampNs;
+        m_lastFrameDurationUs = frameDurationUs;
+        return result;
+    }
+
+    // Same sensor frame delivered again, nothing to measure.
+    if (sequence == m_lastSequence)
+    {
+        m_stats.duplicated++;
+        result.duplicated = true;
+        return result;
+    }
+
+    // Signed difference so that the 32 bit sequence counter may wrap.
+    const auto step = static_cast<int32_t>(sequence - m_lastSequence);
+    if (step < 0)
+    {
+        m_stats.outOfOrder++;
+        result.outOfOrder = true;
+        return result;
+    }
+
+    result.dropped = static_cast<uint32_t>(step - 1);
+    m_stats.dropped += result.dropped;
+
+    const auto intervalUs = (timestampNs - m_lastTimestampNs) / 1000;
+    const auto expectedUs = m_lastFrameDurationUs > 0 ? m_lastFrameDurationUs : m_stats.frameDurationUs;
+    m_lastSequence = sequence;
+    m_lastTimestampNs = timestampNs;
+    m_lastFrameDurationUs = frameDurationUs;
+
+    if (expectedUs <= 0)
+    {
+        return result;
+    }
+
+    // Jitter is measured against the ideal spacing of the frames that were actually
+    // skipped, so a drop does not show up as one huge jitter sample as well.
+    const auto jitterUs = intervalUs - expectedUs * step;
+    m_stats.lastJitterUs = jitterUs;
+    if (std::abs(jitterUs) > m_stats.maxJitterUs)
+    {
+        m_stats.maxJitterUs = std::abs(jitterUs);
+    }
+
+    if (m_windowFill == m_window.size())
+    {
+        m_stats.jitterHistogram[m_window[m_windowPos]]--;
+    }
+    else
+    {
+        m_windowFill++;
+    }
+
+    const auto bin = jitterBin(jitterUs);
+    m_window[m_windowPos] = static_cast<uint8_t>(bin);
+    m_stats.jitterHistogram[bin]++;
+    m_windowPos = (m_windowPos + 1) % m_window.size();
+    return result;
+}
+
+uint64_t FrameMonitor::OnDisplayed(uint64_t latchSequence, unsigned int refreshesPerFrame)
+{
+    std::lock_guard lock(m_mutex);
+    // The previous frame stayed up until this one was latched, so anything beyond the
+    // intended number of refreshes is the display repeating it.
+    uint64_t repeated = 0;
+    if (m_hasLastLatch && latchSequence - m_lastLatchSequence > refreshesPerFrame)
+    {
+        repeated = latchSequence - m_lastLatchSequence - refreshesPerFrame;
+    }
+    m_stats.repeated += repeated;
+    m_hasLastLatch = true;
+    m_lastLatchSequence = latchSequence;
+    return repeated;
+}
+
+FrameMonitor::Stats FrameMonitor::GetStats() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_stats;
+}
+
+void FrameMonitor::Reset()
+{
+    std::lock_guard lock(m_mutex);
+    const auto frameDurationUs = m_stats.frameDurationUs;
+    m_stats = Stats();
+    m_stats.frameDurationUs = frameDurationUs;
+    m_hasLast = false;
+    m_hasLastLatch = false;
+    m_windowPos = 0;
+    m_windowFill = 0;
+}
+
+size_t FrameMonitor::jitterBin(int64_t jitterUs)
+{
+    const auto magnitude = std::abs(jitterUs);
+    for (size_t i = 0; i < JITTER_BIN_BOUNDS_US.size(); i++)
+    {
+        if (magnitude < JITTER_BIN_BOUNDS_US[i])
+        {
+            return i;
+        }
+    }
+    return JITTER_BIN_BOUNDS_US.size();
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Tracks sensor sequence numbers and timestamps of completed frames to detect dropped
+// frames and to measure inter-frame jitter against the frame duration, and the vblanks
+// that latch frames on the display to detect frames shown more often than intended. It
+// knows nothing about libcamera or DRM, so a recorded trace can be replayed through it
+// deterministically.
+class FrameMonitor
+{
+public:
+    // Upper bounds (in microseconds) of the absolute jitter histogram bins. The last
+    // bin collects everything above the final bound.
+    static constexpr std::array<int64_t, 7> JITTER_BIN_BOUNDS_US = { 50, 100, 250, 500, 1000, 2000, 5000 };
+    static constexpr size_t JITTER_BIN_COUNT = JITTER_BIN_BOUNDS_US.size() + 1;
+
+    struct Stats
+    {
+        uint64_t frames = 0;
+        uint64_t dropped = 0;
+        // The same sensor sequence delivered twice in a row. libcamera never does this,
+        // so anything here points at a bug in the pipeline handler or the wrapper.
+        uint64_t duplicated = 0;
+        uint64_t outOfOrder = 0;
+        // Extra refreshes for which the display showed the same frame again because the
+        // next one wasn't ready in time.
+        uint64_t repeated = 0;
+        int64_t frameDurationUs = 0;
+        int64_t lastJitterUs = 0;
+        int64_t maxJitterUs = 0;
+        // Histogram of the absolute jitter over the last `window` intervals.
+        std::array<uint64_t, JITTER_BIN_COUNT> jitterHistogram{};
+    };
+
+    // What OnFrame made of a frame.
+    struct Result
+    {
+        // Frames found missing just before this one.
+        uint32_t dropped = 0;
+        bool duplicated = false;
+        bool outOfOrder = false;
+    };
+
+    explicit FrameMonitor(size_t window = 300);
+
+    // Expected interval between two consecutive sensor frames, as passed in
+    // FrameDurationLimits. With zero, jitter is only measured for frames that report
+    // their own duration.
+    void SetFrameDuration(int64_t frameDurationUs);
+    // `frameDurationUs` is the duration the sensor reported for this frame, when known: a frame's duration
+    // is the interval up to the start of the next one, which is then measured against it
+    // rather than against the configured duration, so deliberate changes (by FramePacer)
+    // don't show up as jitter.
+    Result OnFrame(uint32_t sequence, int64_t timestampNs, int64_t frameDurationUs = 0);
+    // Called for every frame shown, with the vblank that latched it and the number of
+    // refreshes each frame is meant to stay on screen. Returns the number of extra
+    // refreshes the previous frame was shown for.
+    uint64_t OnDisplayed(uint64_t latchSequence, unsigned int refreshesPerFrame);
+    Stats GetStats() const;
+    void Reset();
+
+private:
+    static size_t jitterBin(int64_t jitterUs);
+
+    mutable std::mutex m_mutex;
+    Stats m_stats;
+    bool m_hasLast = false;
+    uint32_t m_lastSequence = 0;
+    int64_t m_lastTimestampNs = 0;
+    int64_t m_lastFrameDurationUs = 0;
+    bool m_hasLastLatch = false;
+    uint64_t m_lastLatchSequence = 0;
+    std::vector<uint8_t> m_window;
+    size_t m_windowPos = 0;
+    size_t m_windowFill = 0;
+};
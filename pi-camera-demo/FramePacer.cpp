@@ -0,0 +1,111 @@
+#include "FramePacer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+int64_t FramePacer::Configure(double refreshHz, double maxFramerate, int64_t minFrameDurationUs, bool control)
+{
+    std::lock_guard lock(m_mutex);
+    const auto displayPeriodNs = static_cast<int64_t>(std::llround(1e9 / refreshHz));
+
+    unsigned int refreshesPerFrame = 1;
+    while (refreshesPerFrame < 8
+        && (displayPeriodNs * refreshesPerFrame < minFrameDurationUs * 1000
+            || 1e9 / (displayPeriodNs * refreshesPerFrame) > maxFramerate * 1.001))
+    {
+        refreshesPerFrame++;
+    }
+
+    m_control = control;
+    m_nominalDurationNs = displayPeriodNs * refreshesPerFrame;
+    m_stats.displayPeriodNs = displayPeriodNs;
+    m_stats.refreshesPerFrame = refreshesPerFrame;
+    resetLoop();
+    return m_stats.frameDurationUs;
+}
+
+void FramePacer::Reset()
+{
+    std::lock_guard lock(m_mutex);
+    resetLoop();
+}
+
+void FramePacer::resetLoop()
+{
+    m_durationNs = m_nominalDurationNs;
+    m_integralNs = 0;
+    m_meanSquareErrorNs = 0;
+    m_inLockFrames = 0;
+    m_hasLastVblank = false;
+
+    const auto displayPeriodNs = m_stats.displayPeriodNs;
+    const auto refreshesPerFrame = m_stats.refreshesPerFrame;
+    m_stats = Stats();
+    m_stats.displayPeriodNs = displayPeriodNs;
+    m_stats.refreshesPerFrame = refreshesPerFrame;
+    m_stats.frameDurationUs = m_durationNs / 1000;
+}
+
+void FramePacer::OnDisplayed(int64_t arrivalNs, uint64_t latchSequence, int64_t latchNs)
+{
+    std::lock_guard lock(m_mutex);
+    const auto period = m_stats.displayPeriodNs;
+    if (period <= 0)
+    {
+        return;
+    }
+
+    // How much later than the target margin ahead of its vblank the frame arrived, so
+    // positive when late. Only the phase matters, so wrap into [-period/2, period/2).
+    const auto margin = std::min(TARGET_MARGIN_NS, period / 2);
+    auto error = ((arrivalNs - latchNs + margin) % period + period) % period;
+    if (error >= period / 2)
+    {
+        error -= period;
+    }
+
+    if (m_hasLastVblank && latchSequence - m_lastLatchSequence != m_stats.refreshesPerFrame)
+    {
+        m_stats.juddered++;
+    }
+    m_hasLastVblank = true;
+    m_lastLatchSequence = latchSequence;
+
+    m_stats.frames++;
+    m_stats.lastPhaseErrorUs = error / 1000;
+    m_meanSquareErrorNs += (static_cast<double>(error) * error - m_meanSquareErrorNs) / 32;
+    m_stats.rmsPhaseErrorUs = std::sqrt(m_meanSquareErrorNs) / 1000;
+
+    m_inLockFrames = std::abs(error) < LOCK_THRESHOLD_NS ? m_inLockFrames + 1 : 0;
+    m_stats.locked = m_inLockFrames >= LOCK_FRAMES;
+
+    if (!m_control)
+    {
+        return;
+    }
+
+    // Arriving late (positive error) shortens the following frames to pull the sensor's
+    // phase earlier, and the other way round. The integral is bounded so that it can't
+    // wind up beyond what a single correction may apply.
+    const auto maxCorrectionNs = MAX_CORRECTION * m_nominalDurationNs;
+    m_integralNs = std::clamp(m_integralNs + error, -maxCorrectionNs / INTEGRAL_GAIN, maxCorrectionNs / INTEGRAL_GAIN);
+    const auto correction = std::clamp(
+        -(PROPORTIONAL_GAIN * error + INTEGRAL_GAIN * m_integralNs),
+        -maxCorrectionNs,
+        maxCorrectionNs);
+    m_durationNs = m_nominalDurationNs + static_cast<int64_t>(correction);
+    m_stats.frameDurationUs = m_durationNs / 1000;
+}
+
+int64_t FramePacer::FrameDurationUs() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_durationNs / 1000;
+}
+
+FramePacer::Stats FramePacer::GetStats() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_stats;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+
+// Matches the sensor frame rate to the display refresh and locks the sensor's phase
+// to vblank. The frame duration is a whole number of refresh periods, so every frame
+// stays on screen for the same number of vblanks, and a PI loop nudges the duration of
+// individual frames so they reach the display a fixed margin before the vblank that
+// latches them. It knows nothing about libcamera or DRM; it is fed timestamps and
+// hands back the frame duration to request.
+class FramePacer
+{
+public:
+    struct Stats
+    {
+        bool locked = false;
+        int64_t displayPeriodNs = 0;
+        unsigned int refreshesPerFrame = 0;
+        int64_t frameDurationUs = 0;
+        int64_t lastPhaseErrorUs = 0;
+        double rmsPhaseErrorUs = 0;
+        uint64_t frames = 0;
+        // Frames that stayed on screen for more or fewer refreshes than intended.
+        uint64_t juddered = 0;
+    };
+
+    // Picks the nominal frame duration: the shortest whole number of refresh periods
+    // that neither exceeds `maxFramerate` nor is shorter than the sensor allows. With
+    // `control` false the pacer only measures.
+    int64_t Configure(double refreshHz, double maxFramerate, int64_t minFrameDurationUs, bool control);
+    // Called for every frame shown, with the time it was ready to be handed to the
+    // display, and the sequence number and time of the vblank that latched it (all
+    // CLOCK_MONOTONIC).
+    void OnDisplayed(int64_t arrivalNs, uint64_t latchSequence, int64_t latchNs);
+    // Starts the loop and statistics afresh, keeping the configuration, for when the
+    // camera is restarted with a new phase.
+    void Reset();
+    // Duration to request for the next frame, in microseconds.
+    int64_t FrameDurationUs() const;
+    Stats GetStats() const;
+
+private:
+    // Hand frames over this long before the vblank that should latch them.
+    static constexpr int64_t TARGET_MARGIN_NS = 2'000'000;
+    static constexpr double PROPORTIONAL_GAIN = 0.05;
+    static constexpr double INTEGRAL_GAIN = 0.005;
+    // Largest correction applied to a single frame, as a fraction of its duration, so
+    // the sensor's exposure limits barely move.
+    static constexpr double MAX_CORRECTION = 0.02;
+    static constexpr int64_t LOCK_THRESHOLD_NS = 500'000;
+    static constexpr unsigned int LOCK_FRAMES = 30;
+
+    void resetLoop();
+
+    mutable std::mutex m_mutex;
+    bool m_control = false;
+    int64_t m_nominalDurationNs = 0;
+    int64_t m_durationNs = 0;
+    double m_integralNs = 0;
+    double m_meanSquareErrorNs = 0;
+    unsigned int m_inLockFrames = 0;
+    bool m_hasLastVblank = false;
+    uint64_t m_lastLatchSequence = 0;
+    Stats m_stats;
+};
@@ -0,0 +1,166 @@
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+#include <spdlog/fmt/fmt.h>
+
+namespace metrics
+{
+    size_t NextShard()
+    {
+        static std::atomic<size_t> nextShard = 0;
+        return nextShard.fetch_add(1, std::memory_order_relaxed) % SHARD_COUNT;
+    }
+
+    uint64_t Counter::Value() const
+    {
+        uint64_t value = 0;
+        for (const auto& shard : m_shards)
+        {
+            value += shard.value.load(std::memory_order_relaxed);
+        }
+        return value;
+    }
+
+    int64_t Gauge::Value() const
+    {
+        auto value = m_value.load(std::memory_order_relaxed);
+        for (const auto& shard : m_shards)
+        {
+            value += shard.value.load(std::memory_order_relaxed);
+        }
+        return value;
+    }
+
+    Histogram::Histogram(std::vector<int64_t> boundsNs) : m_boundsNs(std::move(boundsNs))
+    {
+        if (m_boundsNs.size() > MAX_BOUNDS)
+        {
+            throw std::runtime_error("histogram has more than " + std::to_string(MAX_BOUNDS) + " bucket bounds");
+        }
+        std::sort(m_boundsNs.begin(), m_boundsNs.end());
+    }
+
+    void Histogram::Observe(int64_t valueNs)
+    {
+        size_t bucket = 0;
+        while (bucket < m_boundsNs.size() && valueNs > m_boundsNs[bucket])
+        {
+            bucket++;
+        }
+
+        auto& shard = m_shards[ThreadShard()];
+        shard.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        shard.sumNs.fetch_add(valueNs, std::memory_order_relaxed);
+    }
+
+    void Histogram::Collect(std::vector<uint64_t>& buckets, uint64_t& count, int64_t& sumNs) const
+    {
+        buckets.assign(m_boundsNs.size() + 1, 0);
+        sumNs = 0;
+        for (const auto& shard : m_shards)
+        {
+            for (size_t i = 0; i < buckets.size(); i++)
+            {
+                buckets[i] += shard.buckets[i].load(std::memory_order_relaxed);
+            }
+            sumNs += shard.sumNs.load(std::memory_order_relaxed);
+        }
+
+        for (size_t i = 1; i < buckets.size(); i++)
+        {
+            buckets[i] += buckets[i - 1];
+        }
+        count = buckets.back();
+    }
+
+    template <typename T>
+    static auto findMetric(const std::deque<T>& entries, const std::string& name)
+    {
+        auto item = std::find_if(entries.begin(), entries.end(), [&](const T& entry) { return entry.name == name; });
+        return item == entries.end() ? nullptr : item->metric.get();
+    }
+
+    Counter& Registry::AddCounter(const std::string& name, const std::string& help)
+    {
+        std::lock_guard lock(m_mutex);
+        if (auto existing = findMetric(m_counters, name))
+        {
+            return *existing;
+        }
+        return *m_counters.emplace_back(Entry<Counter>{ name, help, std::make_unique<Counter>() }).metric;
+    }
+
+    Gauge& Registry::AddGauge(const std::string& name, const std::string& help)
+    {
+        std::lock_guard lock(m_mutex);
+        if (auto existing = findMetric(m_gauges, name))
+        {
+            return *existing;
+        }
+        return *m_gauges.emplace_back(Entry<Gauge>{ name, help, std::make_unique<Gauge>() }).metric;
+    }
+
+    Histogram& Registry::AddHistogram(const std::string& name, const std::string& help, std::vector<int64_t> boundsNs)
+    {
+        std::lock_guard lock(m_mutex);
+        if (auto existing = findMetric(m_histograms, name))
+        {
+            return *existing;
+        }
+        return *m_histograms.emplace_back(
+            Entry<Histogram>{ name, help, std::make_unique<Histogram>(std::move(boundsNs)) }).metric;
+    }
+
+    std::string Registry::Render() const
+    {
+        std::lock_guard lock(m_mutex);
+        std::string out;
+        auto inserter = std::back_inserter(out);
+
+        for (const auto& entry : m_counters)
+        {
+            fmt::format_to(inserter, "# HELP {} {}\n# TYPE {} counter\n", entry.name, entry.help, entry.name);
+            fmt::format_to(inserter, "{} {}\n", entry.name, entry.metric->Value());
+        }
+
+        for (const auto& entry : m_gauges)
+        {
+            fmt::format_to(inserter, "# HELP {} {}\n# TYPE {} gauge\n", entry.name, entry.help, entry.name);
+            fmt::format_to(inserter, "{} {}\n", entry.name, entry.metric->Value());
+        }
+
+        std::vector<uint64_t> buckets;
+        for (const auto& entry : m_histograms)
+        {
+            uint64_t count;
+            int64_t sumNs;
+            entry.metric->Collect(buckets, count, sumNs);
+
+            fmt::format_to(inserter, "# HELP {} {}\n# TYPE {} histogram\n", entry.name, entry.help, entry.name);
+            const auto& bounds = entry.metric->Bounds();
+            for (size_t i = 0; i < bounds.size(); i++)
+            {
+                fmt::format_to(inserter, "{}_bucket{{le=\"{}\"}} {}\n", entry.name, bounds[i] / 1e9, buckets[i]);
+            }
+            fmt::format_to(inserter, "{}_bucket{{le=\"+Inf\"}} {}\n", entry.name, count);
+            fmt::format_to(inserter, "{}_sum {}\n", entry.name, sumNs / 1e9);
+            fmt::format_to(inserter, "{}_count {}\n", entry.name, count);
+        }
+
+        return out;
+    }
+
+    Registry& GetRegistry()
+    {
+        static Registry registry;
+        return registry;
+    }
+
+    std::vector<int64_t> CallDurationBounds()
+    {
+        return { 10'000, 25'000, 50'000, 100'000, 250'000, 500'000, 1'000'000, 2'500'000, 5'000'000, 10'000'000, 50'000'000 };
+    }
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Process wide metrics. Counters, gauges and histograms are split into cache line
+// aligned shards picked per thread, so the camera and display threads can update the
+// same metric with a relaxed atomic add and no contention. Reads sum all shards and are
+// only done by the exporter.
+namespace metrics
+{
+    constexpr size_t SHARD_COUNT = 16;
+
+    size_t NextShard();
+
+    // Index of the calling thread's shard. Inline so the hot path is a TLS load.
+    inline size_t ThreadShard()
+    {
+        thread_local const size_t shard = NextShard();
+        return shard;
+    }
+
+    class Counter
+    {
+    public:
+        void Increment(uint64_t value = 1)
+        {
+            m_shards[ThreadShard()].value.fetch_add(value, std::memory_order_relaxed);
+        }
+        uint64_t Value() const;
+
+    private:
+        struct alignas(64) Shard
+        {
+            std::atomic<uint64_t> value = 0;
+        };
+        std::array<Shard, SHARD_COUNT> m_shards;
+    };
+
+    // A gauge is either Set, by one thread at a time, or Added to, from any thread; the
+    // value is what was last Set plus everything Added. Adds go to the calling thread's
+    // shard, so a gauge tracked from both ends (queued and completed) doesn't bounce a
+    // cache line between the threads.
+    class Gauge
+    {
+    public:
+        void Set(int64_t value) { m_value.store(value, std::memory_order_relaxed); }
+        void Add(int64_t value)
+        {
+            m_shards[ThreadShard()].value.fetch_add(value, std::memory_order_relaxed);
+        }
+        int64_t Value() const;
+
+    private:
+        struct alignas(64) Shard
+        {
+            std::atomic<int64_t> value = 0;
+        };
+        alignas(64) std::atomic<int64_t> m_value = 0;
+        std::array<Shard, SHARD_COUNT> m_shards;
+    };
+
+    // Histogram of durations in nanoseconds, exported in seconds as Prometheus expects.
+    class Histogram
+    {
+    public:
+        // Bucket bounds a histogram may have, not counting the +Inf bucket.
+        static constexpr size_t MAX_BOUNDS = 15;
+
+        explicit Histogram(std::vector<int64_t> boundsNs);
+        void Observe(int64_t valueNs);
+        const std::vector<int64_t>& Bounds() const { return m_boundsNs; }
+        // Cumulative count per bucket (plus the +Inf bucket), total count and sum.
+        void Collect(std::vector<uint64_t>& buckets, uint64_t& count, int64_t& sumNs) const;
+
+    private:
+        // The buckets are held inline, so each shard's are on cache lines of its own.
+        struct alignas(64) Shard
+        {
+            std::atomic<int64_t> sumNs = 0;
+            std::array<std::atomic<uint64_t>, MAX_BOUNDS + 1> buckets{};
+        };
+        std::vector<int64_t> m_boundsNs;
+        std::array<Shard, SHARD_COUNT> m_shards;
+    };
+
+    // Measures the lifetime of the scope into a histogram.
+    class ScopedTimer
+    {
+    public:
+        explicit ScopedTimer(Histogram& histogram)
+            : m_histogram(histogram), m_start(std::chrono::steady_clock::now())
+        {
+        }
+        ~ScopedTimer()
+        {
+            const auto elapsed = std::chrono::steady_clock::now() - m_start;
+            m_histogram.Observe(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        }
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    private:
+        Histogram& m_histogram;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    class Registry
+    {
+    public:
+        // Metrics live as long as the process; the returned references stay valid. Adding
+        // a name that already exists returns the existing metric.
+        Counter& AddCounter(const std::string& name, const std::string& help);
+        Gauge& AddGauge(const std::string& name, const std::string& help);
+        Histogram& AddHistogram(const std::string& name, const std::string& help, std::vector<int64_t> boundsNs);
+        // Renders all metrics in the Prometheus text exposition format.
+        std::string Render() const;
+
+    private:
+        template <typename T>
+        struct Entry
+        {
+            std::string name;
+            std::string help;
+            std::unique_ptr<T> metric;
+        };
+
+        mutable std::mutex m_mutex;
+        std::deque<Entry<Counter>> m_counters;
+        std::deque<Entry<Gauge>> m_gauges;
+        std::deque<Entry<Histogram>> m_histograms;
+    };
+
+    Registry& GetRegistry();
+
+    // Bucket bounds suitable for ioctl and driver call durations, 10us to 50ms.
+    std::vector<int64_t> CallDurationBounds();
+}
@@ -0,0 +1,177 @@
+#include "MetricsExporter.hpp"
+
+#include <arpa/inet.h>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include "Resources.hpp"
+
+#define ERRSTR strerror(errno)
+
+MetricsExporter::MetricsExporter(metrics::Registry& registry, const std::string& endpoint) : m_registry(registry)
+{
+    if (endpoint.starts_with("unix:"))
+    {
+        listenUnix(endpoint.substr(5));
+    }
+    else if (endpoint.starts_with("tcp:"))
+    {
+        listenTcp(std::stoi(endpoint.substr(4)));
+    }
+    else
+    {
+        throw std::runtime_error("unsupported metrics endpoint: " + endpoint);
+    }
+
+    m_stopFd = eventfd(0, EFD_CLOEXEC);
+    if (m_stopFd < 0)
+    {
+        close(m_listenFd);
+        throw std::runtime_error("eventfd failed: " + std::string(ERRSTR));
+    }
+
+    m_thread = std::thread(&MetricsExporter::run, this);
+    spdlog::info("Serving metrics on {}", endpoint);
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    const uint64_t value = 1;
+    if (write(m_stopFd, &value, sizeof(value)) < 0)
+    {
+        spdlog::error("Failed to stop metrics exporter: {}", ERRSTR);
+    }
+    m_thread.join();
+
+    close(m_stopFd);
+    close(m_listenFd);
+    if (!m_unixPath.empty())
+    {
+        unlink(m_unixPath.c_str());
+    }
+}
+
+void MetricsExporter::listenUnix(const std::string& path)
+{
+    sockaddr_un address = {};
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        throw std::runtime_error("metrics socket path too long: " + path);
+    }
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    m_listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_listenFd < 0)
+    {
+        throw std::runtime_error("socket failed: " + std::string(ERRSTR));
+    }
+
+    // A previous run that didn't shut down cleanly leaves the socket file behind.
+    unlink(path.c_str());
+    if (bind(m_listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(m_listenFd, 4) < 0)
+    {
+        close(m_listenFd);
+        throw std::runtime_error("failed to listen on " + path + ": " + std::string(ERRSTR));
+    }
+    m_unixPath = path;
+}
+
+void MetricsExporter::listenTcp(int port)
+{
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    m_listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_listenFd < 0)
+    {
+        throw std::runtime_error("socket failed: " + std::string(ERRSTR));
+    }
+
+    const int reuse = 1;
+    setsockopt(m_listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(m_listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(m_listenFd, 4) < 0)
+    {
+        close(m_listenFd);
+        throw std::runtime_error("failed to listen on port " + std::to_string(port) + ": " + std::string(ERRSTR));
+    }
+}
+
+void MetricsExporter::run()
+{
+    pollfd fds[2] = { { m_listenFd, POLLIN, 0 }, { m_stopFd, POLLIN, 0 } };
+    while (true)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            spdlog::error("Metrics exporter poll failed: {}", ERRSTR);
+            return;
+        }
+
+        if (fds[1].revents)
+        {
+            return;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            // Connections come and go whenever a scraper calls, so they are kept out of the
+            // resource reports. The listening socket is non-blocking, so a client that gave
+            // up after the poll can't leave us holding the lock in accept.
+            std::lock_guard lock(resources::transientFdMutex);
+            const auto fd = accept4(m_listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                continue;
+            }
+            serve(fd);
+            close(fd);
+        }
+    }
+}
+
+void MetricsExporter::serve(int fd)
+{
+    // Scrapers send a small HTTP GET; we answer every request with the full metrics page,
+    // but still read the request so the client doesn't see a reset.
+    timeval timeout = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    char request[1024];
+    if (read(fd, request, sizeof(request)) < 0)
+    {
+        return;
+    }
+
+    const auto body = m_registry.Render();
+    const auto response = "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "Connection: close\r\n\r\n" + body;
+
+    size_t written = 0;
+    while (written < response.size())
+    {
+        const auto result = send(fd, response.data() + written, response.size() - written, MSG_NOSIGNAL);
+        if (result <= 0)
+        {
+            return;
+        }
+        written += result;
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <thread>
+
+#include "Metrics.hpp"
+
+// Serves the metrics registry as Prometheus text over HTTP from a background thread.
+// The endpoint is either "unix:<path>" for a Unix domain socket or "tcp:<port>", which
+// only listens on the loopback interface.
+class MetricsExporter
+{
+private:
+    metrics::Registry& m_registry;
+    int m_listenFd = -1;
+    int m_stopFd = -1;
+    std::string m_unixPath;
+    std::thread m_thread;
+
+public:
+    MetricsExporter(metrics::Registry& registry, const std::string& endpoint);
+    ~MetricsExporter();
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+private:
+    void listenUnix(const std::string& path);
+    void listenTcp(int port);
+    void run();
+    void serve(int fd);
+};
@@ -0,0 +1,376 @@
+#include "Overlay.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <drm.h>
+#include <drm_fourcc.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include <spdlog/spdlog.h>
+
+#include "Metrics.hpp"
+#include "Resources.hpp"
+
+#define ERRSTR strerror(errno)
+
+namespace
+{
+    auto& overlayCommits = metrics::GetRegistry().AddCounter(
+        "overlay_commits_total", "Overlay updates put on screen");
+    auto& overlayRedrawnPixels = metrics::GetRegistry().AddCounter(
+        "overlay_redrawn_pixels_total", "Overlay pixels redrawn because their content changed");
+
+    // 5x7 glyphs for ASCII 0x20-0x7e, one byte per column, least significant bit at the top.
+    constexpr unsigned int GLYPH_WIDTH = 5;
+    constexpr unsigned int GLYPH_HEIGHT = 7;
+    constexpr unsigned int CELL_WIDTH = GLYPH_WIDTH + 1;
+    constexpr unsigned int CELL_HEIGHT = GLYPH_HEIGHT + 1;
+    constexpr uint8_t FONT[][GLYPH_WIDTH] = {
+        { 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x5f, 0x00, 0x00 }, { 0x00, 0x07, 0x00, 0x07, 0x00 },
+        { 0x14, 0x7f, 0x14, 0x7f, 0x14 }, { 0x24, 0x2a, 0x7f, 0x2a, 0x12 }, { 0x23, 0x13, 0x08, 0x64, 0x62 },
+        { 0x36, 0x49, 0x55, 0x22, 0x50 }, { 0x00, 0x05, 0x03, 0x00, 0x00 }, { 0x00, 0x1c, 0x22, 0x41, 0x00 },
+        { 0x00, 0x41, 0x22, 0x1c, 0x00 }, { 0x14, 0x08, 0x3e, 0x08, 0x14 }, { 0x08, 0x08, 0x3e, 0x08, 0x08 },
+        { 0x00, 0x50, 0x30, 0x00, 0x00 }, { 0x08, 0x08, 0x08, 0x08, 0x08 }, { 0x00, 0x60, 0x60, 0x00, 0x00 },
+        { 0x20, 0x10, 0x08, 0x04, 0x02 }, { 0x3e, 0x51, 0x49, 0x45, 0x3e }, { 0x00, 0x42, 0x7f, 0x40, 0x00 },
+        { 0x42, 0x61, 0x51, 0x49, 0x46 }, { 0x21, 0x41, 0x45, 0x4b, 0x31 }, { 0x18, 0x14, 0x12, 0x7f, 0x10 },
+        { 0x27, 0x45, 0x45, 0x45, 0x39 }, { 0x3c, 0x4a, 0x49, 0x49, 0x30 }, { 0x01, 0x71, 0x09, 0x05, 0x03 },
+        { 0x36, 0x49, 0x49, 0x49, 0x36 }, { 0x06, 0x49, 0x49, 0x29, 0x1e }, { 0x00, 0x36, 0x36, 0x00, 0x00 },
+        { 0x00, 0x56, 0x36, 0x00, 0x00 }, { 0x08, 0x14, 0x22, 0x41, 0x00 }, { 0x14, 0x14, 0x14, 0x14, 0x14 },
+        { 0x00, 0x41, 0x22, 0x14, 0x08 }, { 0x02, 0x01, 0x51, 0x09, 0x06 }, { 0x32, 0x49, 0x79, 0x41, 0x3e },
+        { 0x7e, 0x11, 0x11, 0x11, 0x7e }, { 0x7f, 0x49, 0x49, 0x49, 0x36 }, { 0x3e, 0x41, 0x41, 0x41, 0x22 },
+        { 0x7f, 0x41, 0x41, 0x22, 0x1c }, { 0x7f, 0x49, 0x49, 0x49, 0x41 }, { 0x7f, 0x09, 0x09, 0x09, 0x01 },
+        { 0x3e, 0x41, 0x49, 0x49, 0x7a }, { 0x7f, 0x08, 0x08, 0x08, 0x7f }, { 0x00, 0x41, 0x7f, 0x41, 0x00 },
+        { 0x20, 0x40, 0x41, 0x3f, 0x01 }, { 0x7f, 0x08, 0x14, 0x22, 0x41 }, { 0x7f, 0x40, 0x40, 0x40, 0x40 },
+        { 0x7f, 0x02, 0x0c, 0x02, 0x7f }, { 0x7f, 0x04, 0x08, 0x10, 0x7f }, { 0x3e, 0x41, 0x41, 0x41, 0x3e },
+        { 0x7f, 0x09, 0x09, 0x09, 0x06 }, { 0x3e, 0x41, 0x51, 0x21, 0x5e }, { 0x7f, 0x09, 0x19, 0x29, 0x46 },
+        { 0x46, 0x49, 0x49, 0x49, 0x31 }, { 0x01, 0x01, 0x7f, 0x01, 0x01 }, { 0x3f, 0x40, 0x40, 0x40, 0x3f },
+        { 0x1f, 0x20, 0x40, 0x20, 0x1f }, { 0x3f, 0x40, 0x38, 0x40, 0x3f }, { 0x63, 0x14, 0x08, 0x14, 0x63 },
+        { 0x07, 0x08, 0x70, 0x08, 0x07 }, { 0x61, 0x51, 0x49, 0x45, 0x43 }, { 0x00, 0x7f, 0x41, 0x41, 0x00 },
+        { 0x02, 0x04, 0x08, 0x10, 0x20 }, { 0x00, 0x41, 0x41, 0x7f, 0x00 }, { 0x04, 0x02, 0x01, 0x02, 0x04 },
+        { 0x40, 0x40, 0x40, 0x40, 0x40 }, { 0x00, 0x01, 0x02, 0x04, 0x00 }, { 0x20, 0x54, 0x54, 0x54, 0x78 },
+        { 0x7f, 0x48, 0x44, 0x44, 0x38 }, { 0x38, 0x44, 0x44, 0x44, 0x20 }, { 0x38, 0x44, 0x44, 0x48, 0x7f },
+        { 0x38, 0x54, 0x54, 0x54, 0x18 }, { 0x08, 0x7e, 0x09, 0x01, 0x02 }, { 0x0c, 0x52, 0x52, 0x52, 0x3e },
+        { 0x7f, 0x08, 0x04, 0x04, 0x78 }, { 0x00, 0x44, 0x7d, 0x40, 0x00 }, { 0x20, 0x40, 0x44, 0x3d, 0x00 },
+        { 0x7f, 0x10, 0x28, 0x44, 0x00 }, { 0x00, 0x41, 0x7f, 0x40, 0x00 }, { 0x7c, 0x04, 0x18, 0x04, 0x78 },
+        { 0x7c, 0x08, 0x04, 0x04, 0x78 }, { 0x38, 0x44, 0x44, 0x44, 0x38 }, { 0x7c, 0x14, 0x14, 0x14, 0x08 },
+        { 0x08, 0x14, 0x14, 0x18, 0x7c }, { 0x7c, 0x08, 0x04, 0x04, 0x08 }, { 0x48, 0x54, 0x54, 0x54, 0x20 },
+        { 0x04, 0x3f, 0x44, 0x40, 0x20 }, { 0x3c, 0x40, 0x40, 0x20, 0x7c }, { 0x1c, 0x20, 0x40, 0x20, 0x1c },
+        { 0x3c, 0x40, 0x30, 0x40, 0x3c }, { 0x44, 0x28, 0x10, 0x28, 0x44 }, { 0x0c, 0x50, 0x50, 0x50, 0x3c },
+        { 0x44, 0x64, 0x54, 0x4c, 0x44 }, { 0x00, 0x08, 0x36, 0x41, 0x00 }, { 0x00, 0x00, 0x7f, 0x00, 0x00 },
+        { 0x00, 0x41, 0x36, 0x08, 0x00 }, { 0x08, 0x04, 0x08, 0x10, 0x08 },
+    };
+
+    // Beyond this many separate damaged areas, redrawing their bounding box is cheaper
+    // than keeping track of them.
+    constexpr size_t MAX_DAMAGE_AREAS = 16;
+
+    bool isEmpty(const libcamera::Rectangle& rect)
+    {
+        return rect.width == 0 || rect.height == 0;
+    }
+
+    libcamera::Rectangle intersect(const libcamera::Rectangle& a, const libcamera::Rectangle& b)
+    {
+        const auto left = std::max<int64_t>(a.x, b.x);
+        const auto top = std::max<int64_t>(a.y, b.y);
+        const auto right = std::min<int64_t>(a.x + static_cast<int64_t>(a.width), b.x + static_cast<int64_t>(b.width));
+        const auto bottom = std::min<int64_t>(a.y + static_cast<int64_t>(a.height), b.y + static_cast<int64_t>(b.height));
+        if (right <= left || bottom <= top)
+        {
+            return {};
+        }
+        return libcamera::Rectangle(left, top, right - left, bottom - top);
+    }
+
+    libcamera::Rectangle unite(const libcamera::Rectangle& a, const libcamera::Rectangle& b)
+    {
+        const auto left = std::min(a.x, b.x);
+        const auto top = std::min(a.y, b.y);
+        const auto right = std::max(a.x + static_cast<int64_t>(a.width), b.x + static_cast<int64_t>(b.width));
+        const auto bottom = std::max(a.y + static_cast<int64_t>(a.height), b.y + static_cast<int64_t>(b.height));
+        return libcamera::Rectangle(left, top, right - left, bottom - top);
+    }
+}
+
+Overlay::Overlay(int drmFd, uint32_t crtcId, uint32_t planeId, const libcamera::Rectangle& area)
+    : m_drmFd(drmFd), m_crtcId(crtcId), m_planeId(planeId), m_area(area)
+{
+    try
+    {
+        for (auto& buffer : m_buffers)
+        {
+            createBuffer(buffer);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        for (auto& buffer : m_buffers)
+        {
+            destroyBuffer(buffer);
+        }
+        throw;
+    }
+}
+
+Overlay::~Overlay()
+{
+    drmModeSetPlane(m_drmFd, m_planeId, m_crtcId, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    for (auto& buffer : m_buffers)
+    {
+        destroyBuffer(buffer);
+    }
+}
+
+void Overlay::SetText(const std::string& name, int x, int y, const std::string& text, uint32_t colour, unsigned int scale)
+{
+    Item item;
+    item.text = text;
+    item.scale = std::max(scale, 1u);
+    item.colour = colour;
+    item.area = textArea(x, y, text, item.scale);
+    setItem(name, std::move(item));
+}
+
+void Overlay::Remove(const std::string& name)
+{
+    std::lock_guard lock(m_mutex);
+    auto item = m_items.find(name);
+    if (item == m_items.end())
+    {
+        return;
+    }
+    damage(item->second.area);
+    m_items.erase(item);
+}
+
+bool Overlay::Commit()
+{
+    std::lock_guard lock(m_mutex);
+    if (m_damage.empty())
+    {
+        return false;
+    }
+
+    // The back buffer was last drawn two commits ago, so it also lacks whatever changed
+    // in the previous commit.
+    auto& buffer = m_buffers[m_backBuffer];
+    auto regions = m_damage;
+    regions.insert(regions.end(), m_previousDamage.begin(), m_previousDamage.end());
+
+    std::vector<drm_clip_rect> clips;
+    for (const auto& region : regions)
+    {
+        redraw(buffer, region);
+        clips.push_back({
+            static_cast<unsigned short>(region.x),
+            static_cast<unsigned short>(region.y),
+            static_cast<unsigned short>(region.x + region.width),
+            static_cast<unsigned short>(region.y + region.height) });
+    }
+
+    if (drmModeSetPlane(
+        m_drmFd,
+        m_planeId,
+        m_crtcId,
+        buffer.fbId,
+        0,
+        m_area.x,
+        m_area.y,
+        m_area.width,
+        m_area.height,
+        0,
+        0,
+        m_area.width << 16,
+        m_area.height << 16))
+    {
+        throw std::runtime_error("drmModeSetPlane failed for overlay: " + std::string(ERRSTR));
+    }
+    // Only needed by drivers that don't scan out of memory directly; others return an
+    // error that we can ignore.
+    drmModeDirtyFB(m_drmFd, buffer.fbId, clips.data(), clips.size());
+
+    overlayCommits.Increment();
+    m_previousDamage = std::move(m_damage);
+    m_damage.clear();
+    m_backBuffer = (m_backBuffer + 1) % BUFFER_COUNT;
+    return true;
+}
+
+void Overlay::createBuffer(Buffer& buffer)
+{
+    drm_mode_create_dumb create = {};
+    create.width = m_area.width;
+    create.height = m_area.height;
+    create.bpp = 32;
+    if (drmIoctl(m_drmFd, DRM_IOCTL_MODE_CREATE_DUMB, &create) < 0)
+    {
+        throw std::runtime_error("DRM_IOCTL_MODE_CREATE_DUMB failed: " + std::string(ERRSTR));
+    }
+    buffer.handle = create.handle;
+    buffer.pitch = create.pitch;
+    buffer.size = create.size;
+    resources::overlayBuffers.Add(1);
+    resources::overlayBufferBytes.Add(static_cast<int64_t>(buffer.size));
+
+    drm_mode_map_dumb map = {};
+    map.handle = buffer.handle;
+    if (drmIoctl(m_drmFd, DRM_IOCTL_MODE_MAP_DUMB, &map) < 0)
+    {
+        throw std::runtime_error("DRM_IOCTL_MODE_MAP_DUMB failed: " + std::string(ERRSTR));
+    }
+    auto memory = mmap(nullptr, buffer.size, PROT_READ | PROT_WRITE, MAP_SHARED, m_drmFd, map.offset);
+    if (memory == MAP_FAILED)
+    {
+        throw std::runtime_error("mmap of overlay buffer failed: " + std::string(ERRSTR));
+    }
+    buffer.pixels = static_cast<uint32_t*>(memory);
+    std::memset(buffer.pixels, 0, buffer.size);
+
+    uint32_t handles[4] = { buffer.handle };
+    uint32_t pitches[4] = { buffer.pitch };
+    uint32_t offsets[4] = { 0 };
+    if (drmModeAddFB2(m_drmFd, m_area.width, m_area.height, DRM_FORMAT_ARGB8888, handles, pitches, offsets, &buffer.fbId, 0))
+    {
+        throw std::runtime_error("drmModeAddFB2 failed for overlay: " + std::string(ERRSTR));
+    }
+}
+
+void Overlay::destroyBuffer(Buffer& buffer)
+{
+    if (buffer.fbId)
+    {
+        drmModeRmFB(m_drmFd, buffer.fbId);
+    }
+    if (buffer.pixels)
+    {
+        munmap(buffer.pixels, buffer.size);
+    }
+    if (buffer.handle)
+    {
+        drm_mode_destroy_dumb destroy = {};
+        destroy.handle = buffer.handle;
+        drmIoctl(m_drmFd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+        resources::overlayBuffers.Add(-1);
+        resources::overlayBufferBytes.Add(-static_cast<int64_t>(buffer.size));
+    }
+    buffer = Buffer();
+}
+
+void Overlay::setItem(const std::string& name, Item item)
+{
+    std::lock_guard lock(m_mutex);
+    auto existing = m_items.find(name);
+    if (existing != m_items.end())
+    {
+        if (existing->second == item)
+        {
+            return;
+        }
+        damage(existing->second.area);
+    }
+    damage(item.area);
+    m_items[name] = std::move(item);
+}
+
+void Overlay::damage(const libcamera::Rectangle& area)
+{
+    const auto clipped = intersect(area, libcamera::Rectangle(0, 0, m_area.width, m_area.height));
+    if (isEmpty(clipped))
+    {
+        return;
+    }
+
+    m_damage.push_back(clipped);
+    if (m_damage.size() > MAX_DAMAGE_AREAS)
+    {
+        auto bounds = m_damage.front();
+        for (const auto& rect : m_damage)
+        {
+            bounds = unite(bounds, rect);
+        }
+        m_damage = { bounds };
+    }
+}
+
+void Overlay::redraw(Buffer& buffer, const libcamera::Rectangle& area)
+{
+    fill(buffer, area, area, 0);
+    overlayRedrawnPixels.Increment(static_cast<uint64_t>(area.width) * area.height);
+
+    for (const auto& [name, item] : m_items)
+    {
+        if (!isEmpty(intersect(item.area, area)))
+        {
+            drawText(buffer, item, area);
+        }
+    }
+}
+
+void Overlay::fill(Buffer& buffer, const libcamera::Rectangle& rect, const libcamera::Rectangle& clip, uint32_t colour)
+{
+    const auto area = intersect(rect, clip);
+    const auto stride = buffer.pitch / sizeof(uint32_t);
+    for (unsigned int y = 0; y < area.height; y++)
+    {
+        auto row = buffer.pixels + (area.y + y) * stride + area.x;
+        std::fill(row, row + area.width, colour);
+    }
+}
+
+void Overlay::drawText(Buffer& buffer, const Item& item, const libcamera::Rectangle& clip)
+{
+    const auto& area = item.area;
+    fill(buffer, area, clip, TEXT_BACKGROUND);
+
+    const auto scale = static_cast<int>(item.scale);
+    auto x = area.x + scale;
+    auto y = area.y + scale;
+    for (const auto c : item.text)
+    {
+        if (c == '\n')
+        {
+            x = area.x + scale;
+            y += CELL_HEIGHT * scale;
+            continue;
+        }
+
+        const auto glyph = (c >= 0x20 && c <= 0x7e) ? FONT[c - 0x20] : FONT['?' - 0x20];
+        for (unsigned int column = 0; column < GLYPH_WIDTH; column++)
+        {
+            for (unsigned int row = 0; row < GLYPH_HEIGHT; row++)
+            {
+                if (glyph[column] & (1 << row))
+                {
+                    fill(
+                        buffer,
+                        libcamera::Rectangle(x + column * scale, y + row * scale, scale, scale),
+                        clip,
+                        item.colour);
+                }
+            }
+        }
+        x += CELL_WIDTH * scale;
+    }
+}
+
+libcamera::Rectangle Overlay::textArea(int x, int y, const std::string& text, unsigned int scale)
+{
+    unsigned int lines = 1;
+    unsigned int columns = 0;
+    unsigned int lineLength = 0;
+    for (const auto c : text)
+    {
+        if (c == '\n')
+        {
+            lines++;
+            lineLength = 0;
+            continue;
+        }
+        columns = std::max(columns, ++lineLength);
+    }
+    // One scaled pixel of padding all round, inside the background.
+    return libcamera::Rectangle(x, y, (columns * CELL_WIDTH + 1) * scale, (lines * CELL_HEIGHT + 1) * scale);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <libcamera/geometry.h>
+
+// ARGB overlay on its own DRM plane, composited over the video by the display hardware.
+// The plane only covers `area`, so its buffers cost memory for the content rather than
+// for the whole video. Content is a set of named text items; changing an item only
+// marks the areas it covered before and after as damaged, and Commit() redraws
+// just those areas into the back buffer and flips it. Nothing is done per video frame,
+// and nothing at all when the content is unchanged.
+class Overlay
+{
+public:
+    static constexpr uint32_t WHITE = 0xffffffff;
+    static constexpr uint32_t TEXT_BACKGROUND = 0x80000000;
+
+    // `area` is where the overlay goes on the screen.
+    Overlay(int drmFd, uint32_t crtcId, uint32_t planeId, const libcamera::Rectangle& area);
+    ~Overlay();
+    Overlay(const Overlay&) = delete;
+    Overlay& operator=(const Overlay&) = delete;
+
+    // Text in overlay pixels, on a translucent background; '\n' starts a new line.
+    void SetText(const std::string& name, int x, int y, const std::string& text, uint32_t colour = WHITE, unsigned int scale = 2);
+    void Remove(const std::string& name);
+    // Redraws the damaged areas and puts them on screen. Returns false if there was
+    // nothing to do.
+    bool Commit();
+
+private:
+    static constexpr unsigned int BUFFER_COUNT = 2;
+
+    struct Buffer
+    {
+        uint32_t handle = 0;
+        uint32_t fbId = 0;
+        uint32_t pitch = 0;
+        size_t size = 0;
+        uint32_t* pixels = nullptr;
+    };
+
+    struct Item
+    {
+        std::string text;
+        unsigned int scale = 1;
+        uint32_t colour = 0;
+        // Area covered by the item, background included.
+        libcamera::Rectangle area;
+
+        bool operator==(const Item& other) const = default;
+    };
+
+    void createBuffer(Buffer& buffer);
+    void destroyBuffer(Buffer& buffer);
+    void setItem(const std::string& name, Item item);
+    void damage(const libcamera::Rectangle& area);
+    void redraw(Buffer& buffer, const libcamera::Rectangle& area);
+    void fill(Buffer& buffer, const libcamera::Rectangle& rect, const libcamera::Rectangle& clip, uint32_t colour);
+    void drawText(Buffer& buffer, const Item& item, const libcamera::Rectangle& clip);
+    static libcamera::Rectangle textArea(int x, int y, const std::string& text, unsigned int scale);
+
+    int m_drmFd;
+    uint32_t m_crtcId;
+    uint32_t m_planeId;
+    libcamera::Rectangle m_area;
+    Buffer m_buffers[BUFFER_COUNT];
+    unsigned int m_backBuffer = 0;
+
+    std::mutex m_mutex;
+    std::map<std::string, Item> m_items;
+    std::vector<libcamera::Rectangle> m_damage;
+    // Damage the back buffer missed while it was on screen.
+    std::vector<libcamera::Rectangle> m_previousDamage;
+};
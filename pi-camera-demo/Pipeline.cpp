@@ -0,0 +1,262 @@
+#include "Pipeline.hpp"
+
+#include <algorithm>
+#include <pthread.h>
+#include <stdexcept>
+
+#include <spdlog/spdlog.h>
+
+#include "CameraWrapper.hpp"
+#include "CpuReadSink.hpp"
+#include "DecimateStage.hpp"
+#include "PreRollSink.hpp"
+#include "PreviewSink.hpp"
+
+FrameQueue::FrameQueue(size_t capacity, DropPolicy dropPolicy, metrics::Gauge& depth)
+    : m_capacity(capacity), m_dropPolicy(dropPolicy), m_depth(depth)
+{
+}
+
+bool FrameQueue::Push(FramePtr frame)
+{
+    // Frames dropped here release their request on the way out of this scope, after
+    // the lock is gone, since that queues the request back to the camera.
+    FramePtr dropped;
+    {
+        std::unique_lock lock(m_mutex);
+        if (m_frames.size() >= m_capacity)
+        {
+            switch (m_dropPolicy)
+            {
+            case DropPolicy::DropOldest:
+                dropped = std::move(m_frames.front());
+                m_frames.pop_front();
+                break;
+            case DropPolicy::DropNewest:
+                return false;
+            case DropPolicy::Block:
+                m_notFull.wait(lock, [this] { return m_frames.size() < m_capacity || m_closed; });
+                break;
+            }
+        }
+        if (m_closed)
+        {
+            return false;
+        }
+        m_frames.push_back(std::move(frame));
+    }
+    // The producer and consumer each add their own side to the depth, which keeps them
+    // off each other's cache lines; an eviction leaves it as it was.
+    if (!dropped)
+    {
+        m_depth.Add(1);
+    }
+    m_notEmpty.notify_one();
+    return dropped == nullptr;
+}
+
+FramePtr FrameQueue::Pop()
+{
+    FramePtr frame;
+    {
+        std::unique_lock lock(m_mutex);
+        m_notEmpty.wait(lock, [this] { return !m_frames.empty() || m_closed; });
+        if (m_frames.empty())
+        {
+            return nullptr;
+        }
+        frame = std::move(m_frames.front());
+        m_frames.pop_front();
+    }
+    m_depth.Add(-1);
+    m_notFull.notify_one();
+    return frame;
+}
+
+void FrameQueue::Close()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_closed = true;
+    }
+    m_notEmpty.notify_all();
+    m_notFull.notify_all();
+}
+
+size_t FrameQueue::Size() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_frames.size();
+}
+
+Pipeline::Pipeline(const PipelineConfig& config, CameraWrapper* camera) : m_camera(camera)
+{
+    auto& registry = metrics::GetRegistry();
+
+    // One preview reports to the camera's frame pacer: the one pacing the camera, or
+    // else the first one seeing every frame, which then only measures.
+    auto pacingNode = std::find_if(config.nodes.begin(), config.nodes.end(), [](const NodeConfig& node) {
+        return node.paceCamera;
+    });
+    if (pacingNode == config.nodes.end())
+    {
+        pacingNode = std::find_if(config.nodes.begin(), config.nodes.end(), [](const NodeConfig& node) {
+            return node.type == "drm_preview" && node.inputs == std::vector<std::string>{ PipelineConfig::SOURCE_NAME };
+        });
+    }
+    m_pacingNodeName = pacingNode != config.nodes.end() ? pacingNode->name : "";
+
+    // The config is topologically sorted, so every node's inputs already exist here.
+    for (const auto& nodeConfig : config.nodes)
+    {
+        auto node = std::make_unique<Node>();
+        node->config = nodeConfig;
+        node->sink = createSink(nodeConfig);
+        node->queue = std::make_unique<FrameQueue>(
+            nodeConfig.queueSize,
+            nodeConfig.dropPolicy,
+            registry.AddGauge(
+                "pipeline_" + nodeConfig.name + "_queue_depth", "Frames waiting in front of node " + nodeConfig.name));
+        node->dropped = &registry.AddCounter(
+            "pipeline_" + nodeConfig.name + "_dropped_total", "Frames dropped by the queue policy of node " + nodeConfig.name);
+
+        for (const auto& input : nodeConfig.inputs)
+        {
+            if (input == PipelineConfig::SOURCE_NAME)
+            {
+                m_sourceConsumers.push_back(node.get());
+                continue;
+            }
+            auto producer = std::find_if(m_nodes.begin(), m_nodes.end(), [&](const std::unique_ptr<Node>& other) {
+                return other->config.name == input;
+            });
+            (*producer)->consumers.push_back(node.get());
+        }
+        m_nodes.push_back(std::move(node));
+    }
+
+    for (auto& node : m_nodes)
+    {
+        if (PipelineConfig::IsStage(node->config.type))
+        {
+            auto consumers = &node->consumers;
+            static_cast<FrameStage*>(node->sink.get())->SetOutput([consumers](FramePtr frame) {
+                distribute(*consumers, frame);
+            });
+        }
+    }
+
+    for (auto& node : m_nodes)
+    {
+        node->thread = std::thread(&Pipeline::run, node.get());
+        setAffinity(node->thread, node->config.cpuAffinity);
+    }
+}
+
+Pipeline::~Pipeline()
+{
+    // In topological order, so that what a stage still has queued reaches its consumers
+    // before they close.
+    for (auto& node : m_nodes)
+    {
+        node->queue->Close();
+        node->thread.join();
+    }
+}
+
+void Pipeline::Push(libcamera::Request* request)
+{
+    auto camera = m_camera;
+    const auto buffer = request->buffers().at(camera->GetVideoStream());
+    auto frame = std::shared_ptr<Frame>(new Frame(), [camera](Frame* frame) {
+        camera->ReuseRequest(frame->request);
+        delete frame;
+    });
+    frame->request = request;
+    frame->buffer = buffer;
+    frame->planes = camera->Mmap(buffer);
+    frame->info = camera->GetStreamInfo();
+    frame->displayCrop = camera->GetDisplayCrop(request);
+    frame->timestampNs = static_cast<int64_t>(buffer->metadata().timestamp);
+    Push(std::move(frame));
+}
+
+void Pipeline::Push(FramePtr frame)
+{
+    distribute(m_sourceConsumers, frame);
+}
+
+void Pipeline::SetInfoText(const std::string& text)
+{
+    for (auto& node : m_nodes)
+    {
+        node->sink->SetInfoText(text);
+    }
+}
+
+void Pipeline::OnEvent()
+{
+    for (auto& node : m_nodes)
+    {
+        node->sink->OnEvent();
+    }
+}
+
+std::unique_ptr<FrameSink> Pipeline::createSink(const NodeConfig& config)
+{
+    if (config.type == "drm_preview")
+    {
+        return std::make_unique<PreviewSink>(config, *m_camera, config.name == m_pacingNodeName);
+    }
+    if (config.type == "pre_roll")
+    {
+        return std::make_unique<PreRollSink>(config);
+    }
+    if (config.type == "cpu_read")
+    {
+        return std::make_unique<CpuReadSink>(config);
+    }
+    if (config.type == "decimate")
+    {
+        return std::make_unique<DecimateStage>(config);
+    }
+    throw std::runtime_error("no implementation for node type " + config.type);
+}
+
+void Pipeline::distribute(const std::vector<Node*>& consumers, const FramePtr& frame)
+{
+    for (auto node : consumers)
+    {
+        if (!node->queue->Push(frame))
+        {
+            node->dropped->Increment();
+        }
+    }
+}
+
+void Pipeline::setAffinity(std::thread& thread, const std::vector<unsigned int>& cpus)
+{
+    if (cpus.empty())
+    {
+        return;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus)
+    {
+        CPU_SET(cpu, &set);
+    }
+    if (pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) != 0)
+    {
+        spdlog::warn("Failed to set CPU affinity");
+    }
+}
+
+void Pipeline::run(Node* node)
+{
+    while (auto frame = node->queue->Pop())
+    {
+        node->sink->Consume(std::move(frame));
+    }
+}
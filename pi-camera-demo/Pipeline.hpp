@@ -0,0 +1,130 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+#include "Metrics.hpp"
+#include "PipelineConfig.hpp"
+#include "stream_info.hpp"
+
+class CameraWrapper;
+
+// A completed source frame on its way through the pipeline. It is shared between all
+// nodes consuming it; the request goes back to the camera when the last reference drops.
+// Frames from a fake source have no request or buffer.
+struct Frame
+{
+    libcamera::Request* request;
+    libcamera::FrameBuffer* buffer;
+    std::vector<libcamera::Span<const uint8_t>> planes;
+    StreamInfo info;
+    libcamera::Rectangle displayCrop;
+    // CLOCK_MONOTONIC time the frame was captured.
+    int64_t timestampNs = 0;
+};
+using FramePtr = std::shared_ptr<const Frame>;
+
+class FrameSink
+{
+public:
+    virtual ~FrameSink() = default;
+    // Called on the node's own thread, one frame at a time.
+    virtual void Consume(FramePtr frame) = 0;
+    // Status text for sinks that can show it; called from any thread.
+    virtual void SetInfoText(const std::string& text) {}
+    // Something worth recording happened; called from any thread.
+    virtual void OnEvent() {}
+};
+
+// A node whose frames go on to the nodes naming it as an input. Consume decides which
+// frames to pass on, from the stage's own thread.
+class FrameStage : public FrameSink
+{
+public:
+    using Output = std::function<void(FramePtr)>;
+    // Set by the pipeline before the first frame arrives.
+    void SetOutput(Output output) { m_output = std::move(output); }
+
+protected:
+    void forward(FramePtr frame) { m_output(std::move(frame)); }
+
+private:
+    Output m_output;
+};
+
+// Bounded queue in front of each node, applying the node's drop policy when full.
+class FrameQueue
+{
+private:
+    const size_t m_capacity;
+    const DropPolicy m_dropPolicy;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+    std::deque<FramePtr> m_frames;
+    bool m_closed = false;
+    metrics::Gauge& m_depth;
+
+public:
+    FrameQueue(size_t capacity, DropPolicy dropPolicy, metrics::Gauge& depth);
+    // Returns false if a frame had to be dropped to honour the drop policy.
+    bool Push(FramePtr frame);
+    // Blocks until a frame is available; returns nullptr once closed and drained.
+    FramePtr Pop();
+    void Close();
+    size_t Size() const;
+};
+
+// Instantiates the nodes of a validated PipelineConfig and distributes camera frames
+// to them. Each node runs on its own thread behind its own queue. Nodes fed by the
+// source can't use the block policy, so a slow node never holds up the camera's
+// completion thread or its sibling nodes; one fed by a stage may, and then holds up only
+// that stage.
+class Pipeline
+{
+private:
+    struct Node
+    {
+        NodeConfig config;
+        std::unique_ptr<FrameSink> sink;
+        std::unique_ptr<FrameQueue> queue;
+        std::thread thread;
+        metrics::Counter* dropped;
+        // Nodes fed by this one, when it is a stage.
+        std::vector<Node*> consumers;
+    };
+
+    CameraWrapper* m_camera;
+    std::vector<std::unique_ptr<Node>> m_nodes;
+    std::vector<Node*> m_sourceConsumers;
+    std::string m_pacingNodeName;
+
+public:
+    // `camera` is null when the source is fake.
+    Pipeline(const PipelineConfig& config, CameraWrapper* camera);
+    ~Pipeline();
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    // Hands a completed request to every node fed by the source.
+    void Push(libcamera::Request* request);
+    void Push(FramePtr frame);
+    // Hands status text to every sink able to show it.
+    void SetInfoText(const std::string& text);
+    // Tells every sink that an event happened, see FrameSink::OnEvent.
+    void OnEvent();
+
+private:
+    std::unique_ptr<FrameSink> createSink(const NodeConfig& config);
+    static void distribute(const std::vector<Node*>& consumers, const FramePtr& frame);
+    static void setAffinity(std::thread& thread, const std::vector<unsigned int>& cpus);
+    static void run(Node* node);
+};
@@ -0,0 +1,507 @@
+#include "PipelineConfig.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+
+#include <nlohmann/json.hpp>
+
+namespace
+{
+    const std::set<std::string> SINK_TYPES = { "drm_preview", "pre_roll", "cpu_read" };
+    const std::set<std::string> STAGE_TYPES = { "decimate" };
+    const std::set<std::string> CPU_READ_MODES = { "direct", "synced", "staged" };
+
+    // "unix:<path>" or "tcp:<port>", as MetricsExporter takes them.
+    void checkMetricsEndpoint(const std::string& endpoint)
+    {
+        if (endpoint.starts_with("unix:") && endpoint.size() > 5)
+        {
+            return;
+        }
+        if (endpoint.starts_with("tcp:"))
+        {
+            const auto port = endpoint.substr(4);
+            if (port.empty() || port.size() > 5 || !std::all_of(port.begin(), port.end(), [](unsigned char c) { return std::isdigit(c); }))
+            {
+                throw std::runtime_error("metrics_endpoint: \"" + port + "\" is not a port number");
+            }
+            const auto number = std::stoi(port);
+            if (number < 1 || number > 65535)
+            {
+                throw std::runtime_error("metrics_endpoint: port " + port + " is out of range");
+            }
+            return;
+        }
+        throw std::runtime_error("metrics_endpoint: expected \"unix:<path>\" or \"tcp:<port>\", not \"" + endpoint + "\"");
+    }
+
+    // A misspelt key would otherwise silently leave its default in place.
+    void checkKeys(const nlohmann::json& object, const std::set<std::string>& keys, const std::string& where)
+    {
+        if (!object.is_object())
+        {
+            throw std::runtime_error(where + ": expected an object");
+        }
+        for (const auto& item : object.items())
+        {
+            if (!keys.contains(item.key()))
+            {
+                throw std::runtime_error(where + ": unknown key \"" + item.key() + "\"");
+            }
+        }
+    }
+
+    // nlohmann::json converts a negative number to an unsigned one by wrapping it, and a
+    // fractional one to an integer by truncating it, so integers are checked up front.
+    template <typename T>
+    void checkNumber(const nlohmann::json& value, const std::string& where)
+    {
+        if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>)
+        {
+            if (value.is_number() && !value.is_number_integer())
+            {
+                throw std::runtime_error(where + ": expected an integer");
+            }
+            if constexpr (std::is_unsigned_v<T>)
+            {
+                if (value.is_number_integer() && !value.is_number_unsigned())
+                {
+                    throw std::runtime_error(where + ": must not be negative");
+                }
+            }
+        }
+    }
+
+    template <typename T>
+    void read(const nlohmann::json& object, const char* key, T& value, const std::string& where)
+    {
+        if (!object.contains(key))
+        {
+            return;
+        }
+        const auto& item = object.at(key);
+        const auto itemWhere = where + "." + key;
+        if constexpr (requires { typename T::value_type; } && !std::is_same_v<T, std::string>)
+        {
+            if (item.is_array())
+            {
+                for (size_t i = 0; i < item.size(); i++)
+                {
+                    checkNumber<typename T::value_type>(item[i], itemWhere + "[" + std::to_string(i) + "]");
+                }
+            }
+        }
+        else
+        {
+            checkNumber<T>(item, itemWhere);
+        }
+        try
+        {
+            value = item.get<T>();
+        }
+        catch (const nlohmann::json::exception& e)
+        {
+            throw std::runtime_error(itemWhere + ": " + e.what());
+        }
+    }
+
+    libcamera::Rectangle parseRectangle(const nlohmann::json& rectangle, const std::string& where)
+    {
+        libcamera::Rectangle value;
+        checkKeys(rectangle, { "x", "y", "width", "height" }, where);
+        read(rectangle, "x", value.x, where);
+        read(rectangle, "y", value.y, where);
+        read(rectangle, "width", value.width, where);
+        read(rectangle, "height", value.height, where);
+        return value;
+    }
+
+    void readRectangle(const nlohmann::json& object, const char* key, libcamera::Rectangle& value, const std::string& where)
+    {
+        if (object.contains(key))
+        {
+            value = parseRectangle(object.at(key), where + "." + key);
+        }
+    }
+
+    libcamera::ColorSpace parseColourSpace(const std::string& name, const std::string& where)
+    {
+        static const std::map<std::string, libcamera::ColorSpace> colourSpaces = {
+            { "raw", libcamera::ColorSpace::Raw },
+            { "jpeg", libcamera::ColorSpace::Jpeg },
+            { "smpte170m", libcamera::ColorSpace::Smpte170m },
+            { "rec709", libcamera::ColorSpace::Rec709 },
+            { "rec2020", libcamera::ColorSpace::Rec2020 },
+        };
+
+        auto item = colourSpaces.find(name);
+        if (item == colourSpaces.end())
+        {
+            throw std::runtime_error(where + ": unknown colour space \"" + name + "\"");
+        }
+        return item->second;
+    }
+
+    DropPolicy parseDropPolicy(const std::string& name, const std::string& where)
+    {
+        if (name == "drop_oldest")
+        {
+            return DropPolicy::DropOldest;
+        }
+        if (name == "drop_newest")
+        {
+            return DropPolicy::DropNewest;
+        }
+        if (name == "block")
+        {
+            return DropPolicy::Block;
+        }
+        throw std::runtime_error(where + ": unknown drop policy \"" + name + "\"");
+    }
+
+    // Each target is either a zoom factor or a region of interest rectangle.
+    std::vector<ZoomTarget> parseZoomTargets(const nlohmann::json& json, const std::string& where)
+    {
+        if (!json.is_array())
+        {
+            throw std::runtime_error(where + ": expected an array");
+        }
+        std::vector<ZoomTarget> targets;
+        for (size_t i = 0; i < json.size(); i++)
+        {
+            const auto itemWhere = where + "[" + std::to_string(i) + "]";
+            ZoomTarget target;
+            if (json[i].is_number())
+            {
+                target.factor = json[i].get<double>();
+            }
+            else
+            {
+                target.region = parseRectangle(json[i], itemWhere);
+            }
+            targets.push_back(target);
+        }
+        return targets;
+    }
+
+    SourceConfig parseSource(const nlohmann::json& json)
+    {
+        const std::string where = "source";
+        checkKeys(
+            json,
+            { "camera", "width", "height", "framerate", "buffer_count", "fake", "pixel_format", "colour_space",
+              "zoom" },
+            where);
+        SourceConfig source;
+        read(json, "camera", source.camera, where);
+        read(json, "width", source.width, where);
+        read(json, "height", source.height, where);
+        read(json, "framerate", source.framerate, where);
+        read(json, "buffer_count", source.bufferCount, where);
+        read(json, "fake", source.fake, where);
+
+        std::string pixelFormat;
+        read(json, "pixel_format", pixelFormat, where);
+        if (!pixelFormat.empty())
+        {
+            source.pixelFormat = libcamera::PixelFormat::fromString(pixelFormat);
+            if (!source.pixelFormat.isValid())
+            {
+                throw std::runtime_error(where + ".pixel_format: unknown format \"" + pixelFormat + "\"");
+            }
+        }
+
+        std::string colourSpace;
+        read(json, "colour_space", colourSpace, where);
+        if (!colourSpace.empty())
+        {
+            source.colourSpace = parseColourSpace(colourSpace, where + ".colour_space");
+        }
+
+        if (json.contains("zoom"))
+        {
+            const auto& zoom = json.at("zoom");
+            const auto zoomWhere = where + ".zoom";
+            checkKeys(zoom, { "targets", "ramp_frames" }, zoomWhere);
+            read(zoom, "ramp_frames", source.zoomRampFrames, zoomWhere);
+            if (zoom.contains("targets"))
+            {
+                source.zoomTargets = parseZoomTargets(zoom.at("targets"), zoomWhere + ".targets");
+            }
+        }
+        return source;
+    }
+
+    NodeConfig parseNode(const nlohmann::json& json, size_t index)
+    {
+        const auto where = "nodes[" + std::to_string(index) + "]";
+        checkKeys(
+            json,
+            { "name", "type", "inputs", "queue_size", "drop_policy", "cpu_affinity", "connector", "destination",
+              "pace_camera", "overlay", "overlay_area", "pre_roll_seconds", "arena_bytes", "output", "cpu_read_modes", "region",
+              "every" },
+            where);
+        NodeConfig node;
+        read(json, "name", node.name, where);
+        read(json, "type", node.type, where);
+        read(json, "inputs", node.inputs, where);
+        read(json, "queue_size", node.queueSize, where);
+        read(json, "cpu_affinity", node.cpuAffinity, where);
+        read(json, "connector", node.connector, where);
+        readRectangle(json, "destination", node.destination, where);
+        read(json, "pace_camera", node.paceCamera, where);
+        read(json, "overlay", node.overlay, where);
+        readRectangle(json, "overlay_area", node.overlayArea, where);
+        read(json, "pre_roll_seconds", node.preRollSeconds, where);
+        read(json, "arena_bytes", node.arenaBytes, where);
+        read(json, "output", node.output, where);
+        read(json, "cpu_read_modes", node.cpuReadModes, where);
+        readRectangle(json, "region", node.region, where);
+        read(json, "every", node.every, where);
+
+        std::string dropPolicy;
+        read(json, "drop_policy", dropPolicy, where);
+        if (!dropPolicy.empty())
+        {
+            node.dropPolicy = parseDropPolicy(dropPolicy, where + ".drop_policy");
+        }
+        return node;
+    }
+}
+
+PipelineConfig PipelineConfig::Load(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        throw std::runtime_error("failed to open pipeline config " + path);
+    }
+
+    nlohmann::json json;
+    try
+    {
+        json = nlohmann::json::parse(file, nullptr, true, true);
+    }
+    catch (const nlohmann::json::exception& e)
+    {
+        throw std::runtime_error(path + ": " + e.what());
+    }
+
+    checkKeys(json, { "source", "nodes", "metrics_endpoint" }, "config");
+    PipelineConfig config = Default();
+    if (json.contains("source"))
+    {
+        config.source = parseSource(json.at("source"));
+    }
+    if (json.contains("nodes"))
+    {
+        config.nodes.clear();
+        const auto& nodes = json.at("nodes");
+        if (!nodes.is_array())
+        {
+            throw std::runtime_error("nodes: expected an array");
+        }
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            config.nodes.push_back(parseNode(nodes[i], i));
+        }
+    }
+    read(json, "metrics_endpoint", config.metricsEndpoint, "config");
+
+    config.Validate();
+    return config;
+}
+
+PipelineConfig PipelineConfig::Default()
+{
+    PipelineConfig config;
+    NodeConfig preview;
+    preview.name = "preview";
+    preview.type = "drm_preview";
+    preview.inputs = { SOURCE_NAME };
+    preview.destination = libcamera::Rectangle(0, 0, 1280, 720);
+    config.nodes.push_back(preview);
+    return config;
+}
+
+void PipelineConfig::Validate()
+{
+    if (source.width == 0 || source.height == 0)
+    {
+        throw std::runtime_error("source: width and height must be non-zero");
+    }
+    if (source.framerate <= 0)
+    {
+        throw std::runtime_error("source.framerate: must be positive");
+    }
+    if (source.bufferCount < 2)
+    {
+        throw std::runtime_error("source.buffer_count: at least 2 buffers are needed");
+    }
+    for (const auto& target : source.zoomTargets)
+    {
+        if (target.region.isNull() && target.factor < 1)
+        {
+            throw std::runtime_error("source.zoom.targets: zoom factors must be at least 1");
+        }
+    }
+    if (!metricsEndpoint.empty())
+    {
+        checkMetricsEndpoint(metricsEndpoint);
+    }
+
+    std::map<std::string, const NodeConfig*> byName;
+    const NodeConfig* pacingNode = nullptr;
+    for (const auto& node : nodes)
+    {
+        const auto where = "node \"" + node.name + "\"";
+        // Names end up in metric names, so keep them to identifier characters.
+        if (node.name.empty() || node.name == SOURCE_NAME
+            || !std::all_of(node.name.begin(), node.name.end(), [](unsigned char c) { return std::isalnum(c) || c == '_'; }))
+        {
+            throw std::runtime_error(where + ": invalid name");
+        }
+        if (!byName.emplace(node.name, &node).second)
+        {
+            throw std::runtime_error(where + ": duplicate name");
+        }
+        if (!SINK_TYPES.contains(node.type) && !STAGE_TYPES.contains(node.type))
+        {
+            throw std::runtime_error(where + ": unknown type \"" + node.type + "\"");
+        }
+        if (node.inputs.empty())
+        {
+            throw std::runtime_error(where + ": no inputs");
+        }
+        if (node.queueSize == 0)
+        {
+            throw std::runtime_error(where + ": queue_size must be at least 1");
+        }
+        const auto fedBySource = std::find(node.inputs.begin(), node.inputs.end(), SOURCE_NAME) != node.inputs.end();
+        if (node.dropPolicy == DropPolicy::Block && fedBySource)
+        {
+            throw std::runtime_error(
+                where + ": block would stall the camera's completion thread, it is only for nodes fed by stages");
+        }
+        for (auto cpu : node.cpuAffinity)
+        {
+            if (cpu >= std::thread::hardware_concurrency())
+            {
+                throw std::runtime_error(where + ": no CPU " + std::to_string(cpu));
+            }
+        }
+        if (node.type == "drm_preview" && source.pixelFormat != libcamera::formats::YUV420)
+        {
+            throw std::runtime_error(where + ": drm_preview only displays YUV420");
+        }
+        if (node.type == "drm_preview" && source.fake)
+        {
+            throw std::runtime_error(where + ": drm_preview needs camera buffers, not a fake source");
+        }
+        if (node.type == "pre_roll" && (node.preRollSeconds <= 0 || node.arenaBytes == 0 || node.output.empty()))
+        {
+            throw std::runtime_error(where + ": pre_roll needs a positive pre_roll_seconds and arena_bytes, and an output");
+        }
+        if (node.type == "cpu_read")
+        {
+            if (node.cpuReadModes.empty())
+            {
+                throw std::runtime_error(where + ": cpu_read_modes is empty");
+            }
+            for (const auto& mode : node.cpuReadModes)
+            {
+                if (!CPU_READ_MODES.contains(mode))
+                {
+                    throw std::runtime_error(where + ": unknown cpu_read mode \"" + mode + "\"");
+                }
+            }
+        }
+        if (node.type == "decimate" && node.every == 0)
+        {
+            throw std::runtime_error(where + ": every must be at least 1");
+        }
+        if (node.overlay && node.type != "drm_preview")
+        {
+            throw std::runtime_error(where + ": only drm_preview has an overlay");
+        }
+        if (node.overlay && !node.overlayArea.isNull() && (node.overlayArea.width == 0 || node.overlayArea.height == 0))
+        {
+            throw std::runtime_error(where + ": overlay_area needs both a width and a height");
+        }
+        if (node.paceCamera)
+        {
+            if (node.type != "drm_preview")
+            {
+                throw std::runtime_error(where + ": only drm_preview can pace the camera");
+            }
+            if (node.inputs != std::vector<std::string>{ SOURCE_NAME })
+            {
+                throw std::runtime_error(where + ": a node pacing the camera needs every frame, so only the source as input");
+            }
+            if (pacingNode)
+            {
+                throw std::runtime_error(where + ": the camera is already paced by \"" + pacingNode->name + "\"");
+            }
+            pacingNode = &node;
+        }
+    }
+
+    std::set<std::string> usedInputs;
+    for (const auto& node : nodes)
+    {
+        for (const auto& input : node.inputs)
+        {
+            if (input != SOURCE_NAME && !byName.contains(input))
+            {
+                throw std::runtime_error("node \"" + node.name + "\": unknown input \"" + input + "\"");
+            }
+            if (input != SOURCE_NAME && !IsStage(byName.at(input)->type))
+            {
+                throw std::runtime_error("node \"" + node.name + "\": input \"" + input + "\" is a sink");
+            }
+            usedInputs.insert(input);
+        }
+    }
+    for (const auto& node : nodes)
+    {
+        if (IsStage(node.type) && !usedInputs.contains(node.name))
+        {
+            throw std::runtime_error("node \"" + node.name + "\": stage feeds no other node");
+        }
+    }
+
+    // Kahn's algorithm: order the nodes so that inputs come first, which also finds cycles.
+    std::vector<NodeConfig> sorted;
+    std::set<std::string> placed = { SOURCE_NAME };
+    auto remaining = nodes;
+    while (!remaining.empty())
+    {
+        auto ready = std::stable_partition(remaining.begin(), remaining.end(), [&](const NodeConfig& node) {
+            return std::all_of(node.inputs.begin(), node.inputs.end(), [&](const std::string& input) {
+                return placed.contains(input);
+            });
+        });
+        if (ready == remaining.begin())
+        {
+            throw std::runtime_error("node \"" + remaining.front().name + "\": inputs form a cycle");
+        }
+        for (auto it = remaining.begin(); it != ready; ++it)
+        {
+            placed.insert(it->name);
+            sorted.push_back(std::move(*it));
+        }
+        remaining.erase(remaining.begin(), ready);
+    }
+    nodes = std::move(sorted);
+}
+
+bool PipelineConfig::IsStage(const std::string& type)
+{
+    return STAGE_TYPES.contains(type);
+}
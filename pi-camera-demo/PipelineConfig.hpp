@@ -0,0 +1,110 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <libcamera/color_space.h>
+#include <libcamera/formats.h>
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+
+// Declarative description of the capture pipeline: one camera source and a DAG of
+// nodes fed by it. Stages pass frames on to the nodes that name them as inputs; sinks
+// are the leaves. Defaults reproduce the built-in behaviour, so an empty config file
+// (or none at all) gives a 1280x720 YUV420 preview.
+// Where SIGUSR2 takes the zoom next, see ZoomController.
+struct ZoomTarget
+{
+    // Zoom factor around the centre of the field of view, when `region` is null.
+    double factor = 1;
+    // Region of interest in sensor coordinates.
+    libcamera::Rectangle region;
+};
+
+struct SourceConfig
+{
+    unsigned int camera = 0;
+    unsigned int width = 1280;
+    unsigned int height = 720;
+    double framerate = 60;
+    unsigned int bufferCount = 6;
+    libcamera::PixelFormat pixelFormat = libcamera::formats::YUV420;
+    libcamera::ColorSpace colourSpace = libcamera::ColorSpace::Rec709;
+    // Generate a test pattern instead of opening a camera, see FakeSource.
+    bool fake = false;
+    // The camera starts at the full field of view; each SIGUSR2 moves on to the next of
+    // these, in a loop, over `zoomRampFrames`.
+    std::vector<ZoomTarget> zoomTargets = { { 2, {} }, { 1, {} } };
+    unsigned int zoomRampFrames = 15;
+};
+
+enum class DropPolicy
+{
+    // Discard the oldest queued frame to make room, keeping latency low.
+    DropOldest,
+    // Discard the incoming frame, keeping what is already queued.
+    DropNewest,
+    // Make the producer wait for room. Only for nodes fed by a stage, which then waits
+    // on its own thread; the camera's completion thread must never wait.
+    Block,
+};
+
+struct NodeConfig
+{
+    std::string name;
+    std::string type;
+    std::vector<std::string> inputs;
+    unsigned int queueSize = 2;
+    DropPolicy dropPolicy = DropPolicy::DropOldest;
+    std::vector<unsigned int> cpuAffinity;
+
+    // drm_preview
+    unsigned int connector = 0;
+    // Null means fullscreen.
+    libcamera::Rectangle destination;
+    // Drive the sensor frame rate and phase from this display's refresh.
+    bool paceCamera = false;
+    // Show frame and pacing stats on an overlay plane over the video.
+    bool overlay = false;
+    // Part of the video the overlay covers, relative to its top left corner; null means
+    // all of it. The default fits the stats text, at a fraction of the memory of a full
+    // size ARGB plane.
+    libcamera::Rectangle overlayArea = libcamera::Rectangle(0, 0, 400, 64);
+
+    // pre_roll
+    // Seconds of frames to keep ahead of an event, as far as the arena allows.
+    double preRollSeconds = 5;
+    size_t arenaBytes = 64 * 1024 * 1024;
+    // Each event writes the frames held to <output>-<n>.yuv.
+    std::string output = "/tmp/pre-roll";
+
+    // cpu_read
+    // Ways of reading frames to take turns with, one per frame, see CpuReadSink.
+    std::vector<std::string> cpuReadModes = { "direct", "synced", "staged" };
+    // Part of the luma plane to read; null means all of it.
+    libcamera::Rectangle region;
+
+    // decimate (stage)
+    // Pass on one frame in every `every`.
+    unsigned int every = 2;
+};
+
+struct PipelineConfig
+{
+    // Name by which nodes refer to the camera source.
+    static constexpr auto SOURCE_NAME = "source";
+
+    SourceConfig source;
+    // Topologically sorted once validated: every node comes after all of its inputs.
+    std::vector<NodeConfig> nodes;
+    // "unix:<path>" or "tcp:<port>"; empty for no metrics.
+    std::string metricsEndpoint = "unix:/tmp/pi-camera-demo-metrics.sock";
+
+    // Loads and validates a JSON pipeline description, throwing std::runtime_error
+    // with the offending key on any problem.
+    static PipelineConfig Load(const std::string& path);
+    static PipelineConfig Default();
+    void Validate();
+    // Whether nodes of `type` pass frames on to other nodes.
+    static bool IsStage(const std::string& type);
+};
@@ -0,0 +1,147 @@
+#include "PreRollBuffer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace
+{
+    constexpr auto NO_SPACE = SIZE_MAX;
+}
+
+PreRollBuffer::PreRollBuffer(size_t arenaBytes, int64_t windowNs)
+    : m_arenaBytes(arenaBytes), m_windowNs(windowNs), m_arena(new uint8_t[arenaBytes])
+{
+    // Touch every page now, so the footprint is committed up front rather than through
+    // page faults while frames are arriving.
+    std::memset(m_arena.get(), 0, m_arenaBytes);
+    m_stats.arenaBytes = m_arenaBytes;
+}
+
+bool PreRollBuffer::Append(int64_t timestampNs, bool keyframe, std::span<const std::span<const uint8_t>> parts)
+{
+    size_t size = 0;
+    for (const auto& part : parts)
+    {
+        size += part.size();
+    }
+
+    std::lock_guard lock(m_mutex);
+    // A group can only start with a keyframe; until one arrives there is nothing to
+    // append to.
+    if (size == 0 || size > m_arenaBytes || (m_entries.empty() && !keyframe))
+    {
+        m_stats.rejected++;
+        return false;
+    }
+
+    size_t offset;
+    while ((offset = findSpace(size)) == NO_SPACE)
+    {
+        evictGroup();
+        if (m_entries.empty() && !keyframe)
+        {
+            // The group this frame belongs to had to go to make room for it.
+            m_stats.rejected++;
+            updateStats();
+            return false;
+        }
+    }
+
+    auto destination = m_arena.get() + offset;
+    for (const auto& part : parts)
+    {
+        std::memcpy(destination, part.data(), part.size());
+        destination += part.size();
+    }
+    m_entries.push_back({ offset, size, timestampNs, keyframe });
+    m_head = offset + size;
+    m_usedBytes += size;
+
+    // Drop the oldest group as long as the next one still reaches back a full window.
+    while (true)
+    {
+        auto next = std::find_if(m_entries.begin() + 1, m_entries.end(), [](const Entry& entry) { return entry.keyframe; });
+        if (next == m_entries.end() || next->timestampNs > timestampNs - m_windowNs)
+        {
+            break;
+        }
+        evictGroup();
+    }
+
+    updateStats();
+    return true;
+}
+
+size_t PreRollBuffer::Flush(const Writer& writer)
+{
+    const auto start = std::chrono::steady_clock::now();
+    std::lock_guard lock(m_mutex);
+
+    std::vector<Record> records;
+    records.reserve(m_entries.size());
+    for (const auto& entry : m_entries)
+    {
+        records.push_back({ entry.timestampNs, entry.keyframe, { m_arena.get() + entry.offset, entry.size } });
+    }
+    writer(records);
+
+    m_entries.clear();
+    m_head = 0;
+    m_usedBytes = 0;
+    m_stats.flushes++;
+    m_stats.lastFlushUs = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    updateStats();
+    return records.size();
+}
+
+PreRollBuffer::Stats PreRollBuffer::GetStats() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_stats;
+}
+
+size_t PreRollBuffer::findSpace(size_t size) const
+{
+    if (m_entries.empty())
+    {
+        return 0;
+    }
+
+    // Live records run from the oldest one's offset up to m_head, possibly wrapping
+    // round the end of the arena. A record never straddles the end; the gap left
+    // there when wrapping stays unused until the ring comes round again.
+    const auto tail = m_entries.front().offset;
+    if (m_head > tail)
+    {
+        if (size <= m_arenaBytes - m_head)
+        {
+            return m_head;
+        }
+        return size <= tail ? 0 : NO_SPACE;
+    }
+    return size <= tail - m_head ? m_head : NO_SPACE;
+}
+
+void PreRollBuffer::evictGroup()
+{
+    do
+    {
+        m_usedBytes -= m_entries.front().size;
+        m_entries.pop_front();
+        m_stats.evicted++;
+    } while (!m_entries.empty() && !m_entries.front().keyframe);
+
+    if (m_entries.empty())
+    {
+        m_head = 0;
+    }
+}
+
+void PreRollBuffer::updateStats()
+{
+    m_stats.usedBytes = m_usedBytes;
+    m_stats.frames = m_entries.size();
+    m_stats.heldNs = m_entries.empty() ? 0 : m_entries.back().timestampNs - m_entries.front().timestampNs;
+}
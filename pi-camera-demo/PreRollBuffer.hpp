@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+// Keeps the most recent frames, at least `windowNs` worth of them when they fit, in one
+// arena allocated up front. Frames are stored back to back in the arena as a ring, and
+// space is only ever reclaimed a whole group of pictures at a time (a keyframe and the
+// frames up to the next one), so what is held always starts with a keyframe. Raw frames
+// are all keyframes. Like FrameMonitor it knows nothing about libcamera.
+class PreRollBuffer
+{
+public:
+    struct Record
+    {
+        int64_t timestampNs;
+        bool keyframe;
+        // Points into the arena; only valid during Flush().
+        std::span<const uint8_t> data;
+    };
+    using Writer = std::function<void(const std::vector<Record>& records)>;
+
+    struct Stats
+    {
+        size_t arenaBytes = 0;
+        size_t usedBytes = 0;
+        size_t frames = 0;
+        int64_t heldNs = 0;
+        // Frames evicted to make room or to stay within the window.
+        uint64_t evicted = 0;
+        // Frames that could not be kept: larger than the arena, or not starting a group.
+        uint64_t rejected = 0;
+        uint64_t flushes = 0;
+        int64_t lastFlushUs = 0;
+    };
+
+    PreRollBuffer(size_t arenaBytes, int64_t windowNs);
+    PreRollBuffer(const PreRollBuffer&) = delete;
+    PreRollBuffer& operator=(const PreRollBuffer&) = delete;
+
+    // Copies the parts of one frame into the arena as a single record. Returns false if
+    // the frame was rejected.
+    bool Append(int64_t timestampNs, bool keyframe, std::span<const std::span<const uint8_t>> parts);
+    // Passes everything held, oldest first, to `writer` straight out of the arena, then
+    // empties the buffer. Appends wait until the writer returns. Returns the frame count.
+    size_t Flush(const Writer& writer);
+    Stats GetStats() const;
+
+private:
+    struct Entry
+    {
+        size_t offset;
+        size_t size;
+        int64_t timestampNs;
+        bool keyframe;
+    };
+
+    // Where a record of `size` bytes would go without evicting anything, or SIZE_MAX.
+    size_t findSpace(size_t size) const;
+    void evictGroup();
+    void updateStats();
+
+    const size_t m_arenaBytes;
+    const int64_t m_windowNs;
+    std::unique_ptr<uint8_t[]> m_arena;
+
+    mutable std::mutex m_mutex;
+    std::deque<Entry> m_entries;
+    // Offset just past the newest record.
+    size_t m_head = 0;
+    size_t m_usedBytes = 0;
+    Stats m_stats;
+};
@@ -0,0 +1,141 @@
+#include "PreRollSink.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include "CpuAccess.hpp"
+
+#define ERRSTR strerror(errno)
+
+namespace
+{
+    std::vector<int64_t> flushDurationBounds()
+    {
+        return { 1'000'000, 5'000'000, 10'000'000, 50'000'000, 100'000'000, 250'000'000, 500'000'000, 1'000'000'000, 5'000'000'000 };
+    }
+}
+
+PreRollSink::PreRollSink(const NodeConfig& config)
+    : m_config(config),
+      m_buffer(config.arenaBytes, static_cast<int64_t>(config.preRollSeconds * 1e9)),
+      m_usedBytes(metrics::GetRegistry().AddGauge(
+          "pre_roll_" + config.name + "_used_bytes", "Bytes of frames held in the arena of node " + config.name)),
+      m_heldFrames(metrics::GetRegistry().AddGauge(
+          "pre_roll_" + config.name + "_frames", "Frames held by node " + config.name)),
+      m_flushDuration(metrics::GetRegistry().AddHistogram(
+          "pre_roll_" + config.name + "_flush_duration_seconds",
+          "Time from an event to the frames held by node " + config.name + " being written",
+          flushDurationBounds()))
+{
+    metrics::GetRegistry()
+        .AddGauge("pre_roll_" + config.name + "_arena_bytes", "Bytes allocated for the arena of node " + config.name)
+        .Set(static_cast<int64_t>(config.arenaBytes));
+}
+
+void PreRollSink::Consume(FramePtr frame)
+{
+    std::vector<std::span<const uint8_t>> parts;
+    for (const auto& plane : frame->planes)
+    {
+        parts.emplace_back(plane.data(), plane.size());
+    }
+    {
+        CpuAccess access(*frame);
+        m_buffer.Append(frame->timestampNs, true, parts);
+    }
+
+    const auto stats = m_buffer.GetStats();
+    m_usedBytes.Set(static_cast<int64_t>(stats.usedBytes));
+    m_heldFrames.Set(static_cast<int64_t>(stats.frames));
+}
+
+void PreRollSink::OnEvent()
+{
+    const auto path = m_config.output + "-" + std::to_string(m_events++) + ".yuv";
+    size_t bytes = 0;
+    int64_t heldNs = 0;
+    try
+    {
+        m_buffer.Flush([&](const std::vector<PreRollBuffer::Record>& records) {
+            for (const auto& record : records)
+            {
+                bytes += record.data.size();
+            }
+            heldNs = records.empty() ? 0 : records.back().timestampNs - records.front().timestampNs;
+            write(path, records);
+        });
+    }
+    catch (const std::exception& e)
+    {
+        spdlog::error("Pre-roll {}: {}", m_config.name, e.what());
+        return;
+    }
+
+    const auto stats = m_buffer.GetStats();
+    m_flushDuration.Observe(stats.lastFlushUs * 1000);
+    m_usedBytes.Set(0);
+    m_heldFrames.Set(0);
+    spdlog::info(
+        "Pre-roll {}: wrote {:.1f}s, {} bytes to {} in {}us; {} frames evicted, {} rejected so far",
+        m_config.name,
+        heldNs / 1e9,
+        bytes,
+        path,
+        stats.lastFlushUs,
+        stats.evicted,
+        stats.rejected);
+}
+
+void PreRollSink::write(const std::string& path, const std::vector<PreRollBuffer::Record>& records)
+{
+    const auto fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        throw std::runtime_error("failed to open " + path + ": " + ERRSTR);
+    }
+
+    // The iovecs point straight into the arena, so the frames go to the kernel without
+    // another copy in between.
+    std::vector<iovec> iov;
+    iov.reserve(records.size());
+    for (const auto& record : records)
+    {
+        iov.push_back({ const_cast<uint8_t*>(record.data.data()), record.data.size() });
+    }
+
+    size_t done = 0;
+    while (done < iov.size())
+    {
+        const auto count = static_cast<int>(std::min<size_t>(iov.size() - done, IOV_MAX));
+        auto written = writev(fd, iov.data() + done, count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            const auto error = std::string(ERRSTR);
+            close(fd);
+            throw std::runtime_error("failed to write " + path + ": " + error);
+        }
+        // Step over what went out, leaving a partly written iovec adjusted to its rest.
+        while (done < iov.size() && static_cast<size_t>(written) >= iov[done].iov_len)
+        {
+            written -= static_cast<ssize_t>(iov[done].iov_len);
+            done++;
+        }
+        if (done < iov.size())
+        {
+            iov[done].iov_base = static_cast<uint8_t*>(iov[done].iov_base) + written;
+            iov[done].iov_len -= written;
+        }
+    }
+    close(fd);
+}
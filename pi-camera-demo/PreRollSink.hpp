@@ -0,0 +1,28 @@
+#pragma once
+
+#include <atomic>
+
+#include "Pipeline.hpp"
+#include "PreRollBuffer.hpp"
+
+// Pipeline node keeping the last few seconds of frames in a PreRollBuffer. An event
+// writes them out to a new file, straight from the arena, on the thread reporting the
+// event. Frames are stored raw, so every one of them is a keyframe.
+class PreRollSink : public FrameSink
+{
+private:
+    NodeConfig m_config;
+    PreRollBuffer m_buffer;
+    std::atomic<unsigned int> m_events = 0;
+    metrics::Gauge& m_usedBytes;
+    metrics::Gauge& m_heldFrames;
+    metrics::Histogram& m_flushDuration;
+
+public:
+    explicit PreRollSink(const NodeConfig& config);
+    void Consume(FramePtr frame) override;
+    void OnEvent() override;
+
+private:
+    static void write(const std::string& path, const std::vector<PreRollBuffer::Record>& records);
+};
@@ -0,0 +1,56 @@
+#include "PreviewSink.hpp"
+
+#include <time.h>
+
+PreviewSink::PreviewSink(const NodeConfig& config, CameraWrapper& camera, bool pacing)
+    : m_camera(camera), m_preview(config.connector, config.destination), m_pacing(pacing)
+{
+    m_preview.SetDoneCallback([this](int fd) { m_shownFrames.erase(fd); });
+    if (m_pacing)
+    {
+        m_camera.EnablePacing(m_preview.RefreshRate(), config.paceCamera);
+    }
+    if (config.overlay)
+    {
+        m_preview.EnableOverlay(config.overlayArea);
+    }
+}
+
+void PreviewSink::Consume(FramePtr frame)
+{
+    const auto fd = frame->buffer->planes()[0].fd.get();
+    const auto& span = frame->planes[0];
+    m_shownFrames[fd] = frame;
+
+    // Arrival has to be taken before Show: on drivers where setting the plane is a
+    // blocking commit it only returns once the vblank that latched the frame has passed,
+    // so a time taken afterwards sits at the same phase whenever the frame came in.
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const auto arrivalNs = now.tv_sec * 1000000000LL + now.tv_nsec;
+    m_preview.Show(fd, span, frame->info, frame->displayCrop);
+    if (!m_pacing)
+    {
+        return;
+    }
+
+    uint64_t latchSequence;
+    int64_t latchNs;
+    if (!m_preview.GetVblank(latchSequence, latchNs))
+    {
+        return;
+    }
+    // Where the commit didn't wait, the last vblank is still the one before arrival and
+    // the frame is latched by the next.
+    if (latchNs < arrivalNs)
+    {
+        latchSequence++;
+        latchNs += static_cast<int64_t>(1e9 / m_preview.RefreshRate());
+    }
+    m_camera.OnFrameDisplayed(arrivalNs, latchSequence, latchNs);
+}
+
+void PreviewSink::SetInfoText(const std::string& text)
+{
+    m_preview.SetInfoText(text);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <map>
+
+#include "CameraWrapper.hpp"
+#include "Pipeline.hpp"
+#include "drm.hpp"
+
+// Pipeline node showing frames on a DRM plane. The frame currently on screen is kept
+// referenced until DrmPreview reports that it has been replaced. The preview chosen
+// for pacing reports every frame's arrival to the camera's frame pacer against the
+// display's vblank.
+class PreviewSink : public FrameSink
+{
+private:
+    CameraWrapper& m_camera;
+    // Declared ahead of the preview so that frames are only released once the preview
+    // has taken them off the screen and dropped its framebuffers.
+    std::map<int, FramePtr> m_shownFrames;
+    DrmPreview m_preview;
+    bool m_pacing;
+
+public:
+    PreviewSink(const NodeConfig& config, CameraWrapper& camera, bool pacing);
+    void Consume(FramePtr frame) override;
+    void SetInfoText(const std::string& text) override;
+};
@@ -0,0 +1,126 @@
+#include "Resources.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include <spdlog/spdlog.h>
+
+namespace resources
+{
+    metrics::Gauge& cameraBuffers = metrics::GetRegistry().AddGauge(
+        "camera_buffers_allocated", "Capture buffers allocated from the camera");
+    metrics::Gauge& cameraMappings = metrics::GetRegistry().AddGauge(
+        "camera_buffer_mappings", "Capture buffer mappings in the process");
+    metrics::Gauge& cameraMappedBytes = metrics::GetRegistry().AddGauge(
+        "camera_buffer_mapped_bytes", "Bytes of capture buffers mapped into the process");
+    metrics::Gauge& previewFramebuffers = metrics::GetRegistry().AddGauge(
+        "preview_buffers_imported", "Camera buffers imported as DRM framebuffers");
+    metrics::Gauge& overlayBuffers = metrics::GetRegistry().AddGauge(
+        "overlay_buffers", "Dumb buffers allocated for overlays");
+    metrics::Gauge& overlayBufferBytes = metrics::GetRegistry().AddGauge(
+        "overlay_buffer_bytes", "Bytes of dumb buffers allocated for overlays");
+    metrics::Gauge& fakeBuffers = metrics::GetRegistry().AddGauge(
+        "fake_source_buffers", "Buffers allocated by the fake source");
+    metrics::Gauge& fakeBufferBytes = metrics::GetRegistry().AddGauge(
+        "fake_source_buffer_bytes", "Bytes of buffers allocated by the fake source");
+
+    std::mutex transientFdMutex;
+
+    namespace
+    {
+        int64_t countOpenFds()
+        {
+            std::error_code error;
+            int64_t count = 0;
+            for (auto it = std::filesystem::directory_iterator("/proc/self/fd", error);
+                 !error && it != std::filesystem::directory_iterator();
+                 it.increment(error))
+            {
+                count++;
+            }
+            // Less the one the iterator itself had open.
+            return error ? -1 : count - 1;
+        }
+
+        int64_t cmaUsedBytes()
+        {
+            std::ifstream meminfo("/proc/meminfo");
+            int64_t totalKb = -1;
+            int64_t freeKb = -1;
+            std::string key;
+            int64_t value;
+            std::string unit;
+            while (meminfo >> key >> value >> unit)
+            {
+                if (key == "CmaTotal:")
+                {
+                    totalKb = value;
+                }
+                else if (key == "CmaFree:")
+                {
+                    freeKb = value;
+                }
+            }
+            return totalKb < 0 || freeKb < 0 ? -1 : (totalKb - freeKb) * 1024;
+        }
+    }
+
+    Report Report::Take()
+    {
+        Report report;
+        report.cameraBuffers = resources::cameraBuffers.Value();
+        report.cameraMappings = resources::cameraMappings.Value();
+        report.cameraMappedBytes = resources::cameraMappedBytes.Value();
+        report.previewFramebuffers = resources::previewFramebuffers.Value();
+        report.overlayBuffers = resources::overlayBuffers.Value();
+        report.overlayBufferBytes = resources::overlayBufferBytes.Value();
+        report.fakeBuffers = resources::fakeBuffers.Value();
+        report.fakeBufferBytes = resources::fakeBufferBytes.Value();
+        {
+            std::lock_guard lock(transientFdMutex);
+            report.openFds = countOpenFds();
+        }
+        report.cmaUsedBytes = resources::cmaUsedBytes();
+        return report;
+    }
+
+    bool LogLeaks(const Report& before, const Report& after, const std::string& when)
+    {
+        const auto fdsLeaked = after.openFds - before.openFds;
+        const auto cmaDelta = before.cmaUsedBytes < 0 || after.cmaUsedBytes < 0 ? 0 : after.cmaUsedBytes - before.cmaUsedBytes;
+        spdlog::info(
+            "Resources after {}: camera buffers {}, mappings {} ({} bytes), preview framebuffers {}, "
+            "overlay buffers {} ({} bytes), fake source buffers {} ({} bytes), fds {:+}, CMA used {:+} bytes",
+            when,
+            after.cameraBuffers,
+            after.cameraMappings,
+            after.cameraMappedBytes,
+            after.previewFramebuffers,
+            after.overlayBuffers,
+            after.overlayBufferBytes,
+            after.fakeBuffers,
+            after.fakeBufferBytes,
+            fdsLeaked,
+            cmaDelta);
+
+        const auto clean = after.cameraBuffers == before.cameraBuffers
+            && after.cameraMappings == before.cameraMappings
+            && after.cameraMappedBytes == before.cameraMappedBytes
+            && after.previewFramebuffers == before.previewFramebuffers
+            && after.overlayBuffers == before.overlayBuffers
+            && after.overlayBufferBytes == before.overlayBufferBytes
+            && after.fakeBuffers == before.fakeBuffers
+            && after.fakeBufferBytes == before.fakeBufferBytes
+            && fdsLeaked == 0;
+        if (!clean)
+        {
+            spdlog::error("Resources were leaked");
+        }
+        if (cmaDelta > 0)
+        {
+            spdlog::warn("{} more bytes of CMA in use after {}", cmaDelta, when);
+        }
+        return clean;
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "Metrics.hpp"
+
+// Accounting of the buffers, mappings and descriptors the process holds, so a run can
+// check that shutdown gave everything back. Each module keeps its own gauges up to date
+// as it acquires and releases things; a Report adds what the kernel says about open fds
+// and CMA.
+namespace resources
+{
+    extern metrics::Gauge& cameraBuffers;
+    extern metrics::Gauge& cameraMappings;
+    extern metrics::Gauge& cameraMappedBytes;
+    extern metrics::Gauge& previewFramebuffers;
+    extern metrics::Gauge& overlayBuffers;
+    extern metrics::Gauge& overlayBufferBytes;
+    extern metrics::Gauge& fakeBuffers;
+    extern metrics::Gauge& fakeBufferBytes;
+
+    // Held by code that opens and closes descriptors of its own accord while the rest of
+    // the process runs, such as the metrics exporter for each connection, across the
+    // descriptor's lifetime. Report::Take holds it too, so it never counts them.
+    extern std::mutex transientFdMutex;
+
+    struct Report
+    {
+        int64_t cameraBuffers = 0;
+        int64_t cameraMappings = 0;
+        int64_t cameraMappedBytes = 0;
+        int64_t previewFramebuffers = 0;
+        int64_t overlayBuffers = 0;
+        int64_t overlayBufferBytes = 0;
+        int64_t fakeBuffers = 0;
+        int64_t fakeBufferBytes = 0;
+        int64_t openFds = 0;
+        // System wide, from /proc/meminfo; -1 if the kernel has no CMA.
+        int64_t cmaUsedBytes = -1;
+
+        static Report Take();
+    };
+
+    // Logs what is still held at `after` compared with `before`, such as at shutdown
+    // compared with startup, `when` saying which. Returns false if anything the process
+    // owns was not released; CMA is only reported, since other processes allocate from
+    // it too.
+    bool LogLeaks(const Report& before, const Report& after, const std::string& when = "shutdown");
+}
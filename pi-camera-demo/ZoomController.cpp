@@ -0,0 +1,233 @@
+#include "ZoomController.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <libcamera/control_ids.h>
+
+#include "Metrics.hpp"
+
+namespace
+{
+    // A crop takes a few frames to go through the ISP, so 5ms up to a quarter second.
+    std::vector<int64_t> stepLatencyBounds()
+    {
+        return { 5'000'000, 10'000'000, 20'000'000, 35'000'000, 50'000'000, 75'000'000, 100'000'000, 150'000'000, 250'000'000 };
+    }
+
+    auto& zoomSteps = metrics::GetRegistry().AddCounter("zoom_steps_total", "Zoom steps attached to requests");
+    auto& zoomStepLatency = metrics::GetRegistry().AddHistogram(
+        "zoom_step_latency_seconds", "Time from a zoom step being queued to its request completing", stepLatencyBounds());
+    auto& zoomStepLatencyFrames = metrics::GetRegistry().AddGauge(
+        "zoom_step_latency_frames", "Sensor frames the last zoom step took to take effect");
+}
+
+void ZoomController::Configure(const libcamera::Rectangle& cropMaximum, const libcamera::Size& outputSize)
+{
+    std::lock_guard lock(m_mutex);
+    m_cropMaximum = cropMaximum;
+    m_outputSize = outputSize;
+    m_steps.clear();
+    m_requestCrops.clear();
+    m_pendingSteps.clear();
+    // Start from the widest field of view that keeps the output aspect ratio, which is
+    // also what the ISP picks when no ScalerCrop is given.
+    m_defaultCrop = fitCrop(
+        cropMaximum.width,
+        cropMaximum.height,
+        cropMaximum.x + cropMaximum.width / 2.0,
+        cropMaximum.y + cropMaximum.height / 2.0);
+    m_currentCrop = m_defaultCrop;
+}
+
+void ZoomController::Reset()
+{
+    std::lock_guard lock(m_mutex);
+    m_requestCrops.clear();
+    m_pendingSteps.clear();
+    if (m_steps.empty() && m_currentCrop != m_defaultCrop)
+    {
+        m_steps.push_back(m_currentCrop);
+    }
+}
+
+void ZoomController::SetZoom(double factor, double centreX, double centreY, unsigned int rampFrames)
+{
+    if (factor < 1.0)
+    {
+        throw std::runtime_error("zoom factor must be at least 1");
+    }
+
+    std::lock_guard lock(m_mutex);
+    if (m_cropMaximum.isNull())
+    {
+        throw std::runtime_error("zoom is not supported by the camera");
+    }
+    const auto target = fitCrop(
+        m_cropMaximum.width / factor,
+        m_cropMaximum.height / factor,
+        m_cropMaximum.x + std::clamp(centreX, 0.0, 1.0) * m_cropMaximum.width,
+        m_cropMaximum.y + std::clamp(centreY, 0.0, 1.0) * m_cropMaximum.height);
+    scheduleCrop(target, rampFrames);
+}
+
+void ZoomController::SetRegionOfInterest(const libcamera::Rectangle& roi, unsigned int rampFrames)
+{
+    if (roi.isNull())
+    {
+        throw std::runtime_error("empty region of interest");
+    }
+
+    std::lock_guard lock(m_mutex);
+    if (m_cropMaximum.isNull())
+    {
+        throw std::runtime_error("zoom is not supported by the camera");
+    }
+    const auto target = fitCrop(
+        roi.width,
+        roi.height,
+        roi.x + roi.width / 2.0,
+        roi.y + roi.height / 2.0);
+    scheduleCrop(target, rampFrames);
+}
+
+void ZoomController::OnQueue(libcamera::Request* request, uint32_t lastSequence)
+{
+    std::lock_guard lock(m_mutex);
+    if (m_cropMaximum.isNull())
+    {
+        return;
+    }
+
+    if (!m_steps.empty())
+    {
+        m_currentCrop = m_steps.front();
+        m_steps.pop_front();
+        request->controls().set(libcamera::controls::ScalerCrop, m_currentCrop);
+        m_pendingSteps[request] = { std::chrono::steady_clock::now(), lastSequence };
+        m_stats.steps++;
+        zoomSteps.Increment();
+    }
+    m_requestCrops[request] = m_currentCrop;
+}
+
+void ZoomController::OnComplete(libcamera::Request* request, uint32_t sequence)
+{
+    std::lock_guard lock(m_mutex);
+    auto item = m_pendingSteps.find(request);
+    if (item == m_pendingSteps.end())
+    {
+        return;
+    }
+
+    const auto latency = std::chrono::steady_clock::now() - item->second.queuedAt;
+    m_stats.lastLatencyUs = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+    m_stats.maxLatencyUs = std::max(m_stats.maxLatencyUs, m_stats.lastLatencyUs);
+    m_stats.lastLatencyFrames = sequence - item->second.lastSequence;
+    zoomStepLatency.Observe(std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count());
+    zoomStepLatencyFrames.Set(m_stats.lastLatencyFrames);
+    m_pendingSteps.erase(item);
+}
+
+libcamera::Rectangle ZoomController::GetDisplayCrop(libcamera::Request* request) const
+{
+    std::lock_guard lock(m_mutex);
+    auto item = m_requestCrops.find(request);
+    if (item == m_requestCrops.end())
+    {
+        return {};
+    }
+
+    const auto applied = request->metadata().get(libcamera::controls::ScalerCrop);
+    if (!applied || applied->isNull() || *applied == item->second)
+    {
+        return {};
+    }
+
+    // Map the requested crop into the coordinates of the output frame, which shows
+    // exactly the applied crop scaled to the output size.
+    const auto requested = item->second.boundedTo(*applied);
+    const auto scaleX = static_cast<double>(m_outputSize.width) / applied->width;
+    const auto scaleY = static_cast<double>(m_outputSize.height) / applied->height;
+    return libcamera::Rectangle(
+        static_cast<int>((requested.x - applied->x) * scaleX),
+        static_cast<int>((requested.y - applied->y) * scaleY),
+        static_cast<unsigned int>(requested.width * scaleX),
+        static_cast<unsigned int>(requested.height * scaleY));
+}
+
+ZoomController::Stats ZoomController::GetStats() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_stats;
+}
+
+libcamera::Rectangle ZoomController::fitCrop(double width, double height, double centreX, double centreY) const
+{
+    const auto aspect = static_cast<double>(m_outputSize.width) / m_outputSize.height;
+    if (width / height < aspect)
+    {
+        width = height * aspect;
+    }
+    else
+    {
+        height = width / aspect;
+    }
+
+    if (width > m_cropMaximum.width)
+    {
+        width = m_cropMaximum.width;
+        height = width / aspect;
+    }
+    if (height > m_cropMaximum.height)
+    {
+        height = m_cropMaximum.height;
+        width = height * aspect;
+    }
+
+    const auto x = std::clamp(
+        centreX - width / 2,
+        static_cast<double>(m_cropMaximum.x),
+        m_cropMaximum.x + m_cropMaximum.width - width);
+    const auto y = std::clamp(
+        centreY - height / 2,
+        static_cast<double>(m_cropMaximum.y),
+        m_cropMaximum.y + m_cropMaximum.height - height);
+
+    return libcamera::Rectangle(
+        static_cast<int>(std::lround(x)),
+        static_cast<int>(std::lround(y)),
+        static_cast<unsigned int>(std::lround(width)),
+        static_cast<unsigned int>(std::lround(height)));
+}
+
+void ZoomController::scheduleCrop(const libcamera::Rectangle& target, unsigned int rampFrames)
+{
+    // A new target replaces whatever is left of the previous ramp and starts from the
+    // crop the most recently queued request carries.
+    m_steps.clear();
+
+    const auto start = m_currentCrop;
+    const auto count = std::max(rampFrames, 1u);
+    const auto startCentreX = start.x + start.width / 2.0;
+    const auto startCentreY = start.y + start.height / 2.0;
+    const auto targetCentreX = target.x + target.width / 2.0;
+    const auto targetCentreY = target.y + target.height / 2.0;
+
+    for (unsigned int i = 1; i < count; i++)
+    {
+        // Sizes change geometrically so the perceived zoom speed stays constant.
+        const auto t = static_cast<double>(i) / count;
+        const auto width = start.width * std::pow(static_cast<double>(target.width) / start.width, t);
+        const auto height = start.height * std::pow(static_cast<double>(target.height) / start.height, t);
+        const auto centreX = startCentreX + (targetCentreX - startCentreX) * t;
+        const auto centreY = startCentreY + (targetCentreY - startCentreY) * t;
+        m_steps.push_back(libcamera::Rectangle(
+            static_cast<int>(std::lround(centreX - width / 2)),
+            static_cast<int>(std::lround(centreY - height / 2)),
+            static_cast<unsigned int>(std::lround(width)),
+            static_cast<unsigned int>(std::lround(height))));
+    }
+    m_steps.push_back(target);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+
+#include <libcamera/geometry.h>
+#include <libcamera/request.h>
+
+// Drives digital zoom through the ISP's ScalerCrop control. Zoom targets are turned into
+// a ramp of crop rectangles, one of which is attached to each request as it is queued, so
+// the zoom advances exactly one step per frame and the CPU never touches pixel data.
+class ZoomController
+{
+public:
+    struct Stats
+    {
+        uint64_t steps = 0;
+        // Time and number of sensor frames between a crop being attached to a request
+        // and that request completing with it applied.
+        int64_t lastLatencyUs = 0;
+        int64_t maxLatencyUs = 0;
+        uint32_t lastLatencyFrames = 0;
+    };
+
+    // Must be called once the camera is configured, as the crop limits depend on the
+    // selected sensor mode.
+    void Configure(const libcamera::Rectangle& cropMaximum, const libcamera::Size& outputSize);
+    // Zoom by `factor` (>= 1) around a centre given in normalised [0, 1] coordinates of
+    // the full field of view, spreading the change over `rampFrames` frames.
+    void SetZoom(double factor, double centreX, double centreY, unsigned int rampFrames);
+    // Zoom onto a region given in sensor coordinates. The region is grown to the output
+    // aspect ratio so the ISP never stretches the image.
+    void SetRegionOfInterest(const libcamera::Rectangle& roi, unsigned int rampFrames);
+
+    // Forgets the requests in flight, which a stopped camera has given back. The ISP
+    // starts from its default crop again, so a zoom in place goes out again with the
+    // first request queued after a restart.
+    void Reset();
+    void OnQueue(libcamera::Request* request, uint32_t lastSequence);
+    void OnComplete(libcamera::Request* request, uint32_t sequence);
+    // The part of the output frame the display should show. The ISP may round the
+    // requested crop (alignment, limits); the difference is taken up by the display
+    // plane's source rectangle so that what is shown always matches what was asked
+    // for in that very frame. A null rectangle means the whole frame.
+    libcamera::Rectangle GetDisplayCrop(libcamera::Request* request) const;
+    Stats GetStats() const;
+
+private:
+    struct PendingStep
+    {
+        std::chrono::steady_clock::time_point queuedAt;
+        uint32_t lastSequence;
+    };
+
+    libcamera::Rectangle fitCrop(double width, double height, double centreX, double centreY) const;
+    void scheduleCrop(const libcamera::Rectangle& target, unsigned int rampFrames);
+
+    mutable std::mutex m_mutex;
+    libcamera::Rectangle m_cropMaximum;
+    libcamera::Size m_outputSize;
+    libcamera::Rectangle m_defaultCrop;
+    libcamera::Rectangle m_currentCrop;
+    std::deque<libcamera::Rectangle> m_steps;
+    std::map<libcamera::Request*, libcamera::Rectangle> m_requestCrops;
+    std::map<libcamera::Request*, PendingStep> m_pendingSteps;
+    Stats m_stats;
+};
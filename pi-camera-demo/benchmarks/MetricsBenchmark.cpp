@@ -0,0 +1,72 @@
+// Measures the cost of updating metrics from one and from several threads at once, as
+// the camera, display and node threads do, against a single shared atomic for
+// comparison. Each thread makes the same number of updates and the time is divided by
+// that number, so with a core per thread, flat across thread counts means no contention.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "Metrics.hpp"
+
+namespace
+{
+    constexpr int UPDATES = 20'000'000;
+
+    double run(unsigned int threadCount, const std::function<void(int)>& update)
+    {
+        std::atomic<bool> go = false;
+        std::vector<std::thread> threads;
+        for (unsigned int i = 0; i < threadCount; i++)
+        {
+            threads.emplace_back([&] {
+                while (!go.load(std::memory_order_acquire))
+                {
+                }
+                for (int j = 0; j < UPDATES; j++)
+                {
+                    update(j);
+                }
+            });
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        go.store(true, std::memory_order_release);
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration<double, std::nano>(elapsed).count() / UPDATES;
+    }
+}
+
+int main()
+{
+    auto& registry = metrics::GetRegistry();
+    auto& counter = registry.AddCounter("benchmark_counter_total", "Counter");
+    auto& gauge = registry.AddGauge("benchmark_gauge", "Gauge");
+    auto& histogram = registry.AddHistogram("benchmark_histogram_seconds", "Histogram", metrics::CallDurationBounds());
+    alignas(64) std::atomic<int64_t> shared = 0;
+
+    std::printf("%-20s %8s %12s\n", "metric", "threads", "ns/update");
+    for (auto threadCount : { 1u, 2u, 4u })
+    {
+        std::printf("%-20s %8u %12.2f\n", "shared atomic", threadCount,
+            run(threadCount, [&](int) { shared.fetch_add(1, std::memory_order_relaxed); }));
+        std::printf("%-20s %8u %12.2f\n", "Counter::Increment", threadCount,
+            run(threadCount, [&](int) { counter.Increment(); }));
+        std::printf("%-20s %8u %12.2f\n", "Gauge::Add", threadCount,
+            run(threadCount, [&](int j) { gauge.Add(j & 1 ? 1 : -1); }));
+        std::printf("%-20s %8u %12.2f\n", "Histogram::Observe", threadCount,
+            run(threadCount, [&](int j) { histogram.Observe(j % 3'000'000); }));
+    }
+
+    // Keeps the updates from being optimised away.
+    std::printf("%lld\n", static_cast<long long>(shared.load() + counter.Value() + gauge.Value()));
+    return 0;
+}
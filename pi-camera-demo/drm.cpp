@@ -19,9 +19,22 @@
 #include <asm-generic/ioctl.h>
 #include <libcamera/color_space.h>
 
+#include "Metrics.hpp"
+#include "Overlay.hpp"
+#include "Resources.hpp"
+
 #define ERRSTR strerror(errno)
 
-DrmPreview::DrmPreview() : last_fd_(-1), first_time_(true)
+namespace
+{
+    auto& framesShown = metrics::GetRegistry().AddCounter(
+        "preview_frames_shown_total", "Frames put on the display plane");
+    auto& setPlaneDuration = metrics::GetRegistry().AddHistogram(
+        "preview_set_plane_duration_seconds", "Time spent in drmModeSetPlane", metrics::CallDurationBounds());
+}
+
+DrmPreview::DrmPreview(int connectorId, const libcamera::Rectangle& destination)
+    : destination_(destination), last_fd_(-1), first_time_(true)
 {
     m_drmfd = drmOpen("vc4", nullptr);
     if (m_drmfd < 0)
@@ -41,14 +54,18 @@ DrmPreview::DrmPreview() : last_fd_(-1), first_time_(true)
             throw std::runtime_error("DRM preview unavailable - not master");
         }
 
-        conId_ = 0;
+        conId_ = connectorId;
         findCrtc();
         out_fourcc_ = DRM_FORMAT_YUV420;
-        findPlane();
+        planeId_ = findPlane(out_fourcc_);
+        if (!planeId_)
+        {
+            throw std::runtime_error("drm: no plane supports YUV420");
+        }
     }
     catch (const std::exception& e)
     {
-        close(m_drmfd);
+        drmClose(m_drmfd);
         throw;
     }
 
@@ -56,6 +73,19 @@ DrmPreview::DrmPreview() : last_fd_(-1), first_time_(true)
 
     width_ = screen_width_;
     height_ = screen_height_;
+    if (destination_.isNull())
+    {
+        destination_ = libcamera::Rectangle(0, 0, width_, height_);
+    }
+}
+
+DrmPreview::~DrmPreview()
+{
+    overlay_.reset();
+    // Take the video off the screen before its framebuffers go.
+    drmModeSetPlane(m_drmfd, planeId_, crtcId_, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    Reset();
+    drmClose(m_drmfd);
 }
 
 
@@ -70,53 +100,72 @@ void DrmPreview::findCrtc()
 
     if (res->count_crtcs <= 0)
     {
+        drmModeFreeResources(res);
         throw std::runtime_error("drm: no crts");
     }
 
     max_image_width_ = res->max_width;
     max_image_height_ = res->max_height;
 
-    if (!conId_)
+    // With no connector requested, pick the first one that is driving a CRTC.
+    const bool connectorRequested = conId_ != 0;
+    if (!connectorRequested)
     {
         std::cerr << "No connector ID specified.  Choosing default from list:" << std::endl;
+    }
 
-        for (i = 0; i < res->count_connectors; i++)
+    bool chosen = false;
+    for (i = 0; i < res->count_connectors; i++)
+    {
+        auto con = drmModeGetConnector(m_drmfd, res->connectors[i]);
+        if (!con)
         {
-            auto con = drmModeGetConnector(m_drmfd, res->connectors[i]);
-            drmModeEncoder* enc = nullptr;
-            drmModeCrtc* crtc = nullptr;
-
-            if (con->encoder_id)
-            {
-                enc = drmModeGetEncoder(m_drmfd, con->encoder_id);
-                if (enc->crtc_id)
-                {
-                    crtc = drmModeGetCrtc(m_drmfd, enc->crtc_id);
-                }
-            }
+            continue;
+        }
+        drmModeEncoder* enc = nullptr;
+        drmModeCrtc* crtc = nullptr;
 
-            if (!conId_ && crtc)
+        if (con->encoder_id)
+        {
+            enc = drmModeGetEncoder(m_drmfd, con->encoder_id);
+            if (enc && enc->crtc_id)
             {
-                conId_ = con->connector_id;
-                crtcId_ = crtc->crtc_id;
+                crtc = drmModeGetCrtc(m_drmfd, enc->crtc_id);
             }
+        }
 
-            if (crtc)
-            {
-                screen_width_ = crtc->width;
-                screen_height_ = crtc->height;
-            }
+        const bool isChosen = !chosen && crtc
+            && (!connectorRequested || conId_ == static_cast<int>(con->connector_id));
+        if (isChosen)
+        {
+            chosen = true;
+            conId_ = con->connector_id;
+            crtcId_ = crtc->crtc_id;
+            screen_width_ = crtc->width;
+            screen_height_ = crtc->height;
+        }
 
+        std::cerr << "Connector " << con->connector_id << " (crtc " << (crtc ? crtc->crtc_id : 0) << "): type "
+            << con->connector_type << ", " << (crtc ? crtc->width : 0) << "x" << (crtc ? crtc->height : 0)
+            << (isChosen ? " (chosen)" : "") << std::endl;
 
-            std::cerr << "Connector " << con->connector_id << " (crtc " << (crtc ? crtc->crtc_id : 0) << "): type "
-                << con->connector_type << ", " << (crtc ? crtc->width : 0) << "x" << (crtc ? crtc->height : 0)
-                << (conId_ == static_cast<int>(con->connector_id) ? " (chosen)" : "") << std::endl;
+        if (crtc)
+        {
+            drmModeFreeCrtc(crtc);
         }
-
-        if (!conId_)
+        if (enc)
         {
-            throw std::runtime_error("No suitable enabled connector found");
+            drmModeFreeEncoder(enc);
         }
+        drmModeFreeConnector(con);
+    }
+
+    if (!chosen)
+    {
+        drmModeFreeResources(res);
+        throw std::runtime_error(connectorRequested
+            ? "Connector " + std::to_string(conId_) + " not found or not enabled"
+            : "No suitable enabled connector found");
     }
 
     crtcIdx_ = -1;
@@ -157,19 +206,44 @@ void DrmPreview::findCrtc()
         throw std::runtime_error("connector supports no mode");
     }
 
+    drmModeFreeConnector(c);
+    drmModeFreeResources(res);
+
     auto crtc = drmModeGetCrtc(m_drmfd, crtcId_);
+    if (!crtc)
+    {
+        throw std::runtime_error("drmModeGetCrtc failed: " + std::string(ERRSTR));
+    }
 
     width_ = crtc->width;
     height_ = crtc->height;
+
+    // The mode's nominal vrefresh is rounded to whole Hz, which is not good enough to
+    // pace against (59.94 vs 60), so work it out from the pixel clock instead.
+    const auto& mode = crtc->mode;
+    refresh_rate_ = mode.vrefresh;
+    if (crtc->mode_valid && mode.htotal && mode.vtotal)
+    {
+        refresh_rate_ = mode.clock * 1000.0 / (mode.htotal * mode.vtotal);
+        if (mode.flags & DRM_MODE_FLAG_INTERLACE)
+        {
+            refresh_rate_ *= 2;
+        }
+        if (mode.vscan > 1)
+        {
+            refresh_rate_ /= mode.vscan;
+        }
+    }
     drmModeFreeCrtc(crtc);
 }
 
-void DrmPreview::findPlane()
+uint32_t DrmPreview::findPlane(unsigned int fourcc, uint32_t exclude)
 {
     drmModePlaneResPtr planes;
     drmModePlanePtr plane;
     unsigned int i;
     unsigned int j;
+    uint32_t planeId = 0;
 
     planes = drmModeGetPlaneResources(m_drmfd);
     if (!planes)
@@ -182,12 +256,12 @@ void DrmPreview::findPlane()
         for (i = 0; i < planes->count_planes; ++i)
         {
             plane = drmModeGetPlane(m_drmfd, planes->planes[i]);
-            if (!planes)
+            if (!plane)
             {
                 throw std::runtime_error("drmModeGetPlane failed: " + std::string(ERRSTR));
             }
 
-            if (!(plane->possible_crtcs & (1 << crtcIdx_)))
+            if (!(plane->possible_crtcs & (1 << crtcIdx_)) || plane->plane_id == exclude)
             {
                 drmModeFreePlane(plane);
                 continue;
@@ -195,7 +269,7 @@ void DrmPreview::findPlane()
 
             for (j = 0; j < plane->count_formats; ++j)
             {
-                if (plane->formats[j] == out_fourcc_)
+                if (plane->formats[j] == fourcc)
                 {
                     break;
                 }
@@ -207,7 +281,7 @@ void DrmPreview::findPlane()
                 continue;
             }
 
-            planeId_ = plane->plane_id;
+            planeId = plane->plane_id;
 
             drmModeFreePlane(plane);
             break;
@@ -220,6 +294,7 @@ void DrmPreview::findPlane()
     }
 
     drmModeFreePlaneResources(planes);
+    return planeId;
 }
 
 
@@ -314,6 +389,33 @@ done:
     return ret;
 }
 
+// Sets a range property, such as zpos, to the top of its range.
+static int drm_set_property_max(int fd, int plane_id, const char* name)
+{
+    auto properties = drmModeObjectGetProperties(fd, plane_id, DRM_MODE_OBJECT_PLANE);
+    if (!properties)
+    {
+        return -1;
+    }
+
+    auto ret = -1;
+    for (unsigned int i = 0; i < properties->count_props && ret < 0; i++)
+    {
+        auto prop = drmModeGetProperty(fd, properties->props[i]);
+        if (!prop)
+        {
+            continue;
+        }
+        if (drm_property_type_is(prop, DRM_MODE_PROP_RANGE) && !strcmp(prop->name, name) && prop->count_values == 2)
+        {
+            ret = drmModeObjectSetProperty(fd, plane_id, DRM_MODE_OBJECT_PLANE, prop->prop_id, prop->values[1]);
+        }
+        drmModeFreeProperty(prop);
+    }
+    drmModeFreeObjectProperties(properties);
+    return ret;
+}
+
 static void setup_colour_space(int fd, int plane_id, const std::optional<libcamera::ColorSpace>& cs)
 {
     const char *encoding, *range;
@@ -323,6 +425,19 @@ static void setup_colour_space(int fd, int plane_id, const std::optional<libcame
     drm_set_property(fd, plane_id, "COLOR_RANGE", range);
 }
 
+static void close_gem_handle(int fd, uint32_t handle)
+{
+    // Apparently a "bo_handle" is a "gem" thing, and it needs closing. It feels like there
+    // ought be an API to match "drmPrimeFDToHandle" for this, but I can only find an ioctl.
+    drm_gem_close gem_close = {};
+    gem_close.handle = handle;
+    if (drmIoctl(fd, DRM_IOCTL_GEM_CLOSE, &gem_close) < 0)
+    {
+        // I have no idea what this would mean, so complain and try to carry on...
+        std::cerr << "DRM_IOCTL_GEM_CLOSE failed" << std::endl;
+    }
+}
+
 void DrmPreview::makeBuffer(int fd, size_t size, const StreamInfo& info, Buffer& buffer)
 {
     if (first_time_)
@@ -348,35 +463,53 @@ void DrmPreview::makeBuffer(int fd, size_t size, const StreamInfo& info, Buffer&
 
     if (drmModeAddFB2(m_drmfd, info.width, info.height, out_fourcc_, bo_handles, pitches, offsets, &buffer.fb_handle, 0))
     {
-        throw std::runtime_error("drmModeAddFB2 failed: " + std::string(ERRSTR));
+        const auto error = std::string(ERRSTR);
+        close_gem_handle(m_drmfd, buffer.bo_handle);
+        throw std::runtime_error("drmModeAddFB2 failed: " + error);
     }
+    resources::previewFramebuffers.Add(1);
 }
 
-void DrmPreview::Show(int fd, libcamera::Span<uint8_t> span, const StreamInfo& info)
+void DrmPreview::Show(int fd, libcamera::Span<const uint8_t> span, const StreamInfo& info, const libcamera::Rectangle& crop)
 {
-    auto& buffer = buffers_[fd];
-    if (buffer.fd == -1)
-    {
-        makeBuffer(fd, span.size(), info, buffer);
-    }
-
-    if (drmModeSetPlane(
-        m_drmfd,
-        planeId_,
-        crtcId_,
-        buffer.fb_handle,
-        0,
-        0,
-        0,
-        1280,
-        720,
-        0,
-        0,
-        buffer.info.width << 16,
-        buffer.info.height << 16))
+    // Only a buffer imported in full goes into the map, so if the import fails Reset
+    // doesn't release handles that were never set up.
+    auto it = buffers_.find(fd);
+    if (it == buffers_.end())
+    {
+        Buffer imported;
+        makeBuffer(fd, span.size(), info, imported);
+        it = buffers_.emplace(fd, imported).first;
+    }
+    const auto& buffer = it->second;
+
+    const auto src = crop.isNull()
+        ? libcamera::Rectangle(0, 0, buffer.info.width, buffer.info.height)
+        : crop.boundedTo(libcamera::Rectangle(0, 0, buffer.info.width, buffer.info.height));
+
+    int result;
+    {
+        metrics::ScopedTimer timer(setPlaneDuration);
+        result = drmModeSetPlane(
+            m_drmfd,
+            planeId_,
+            crtcId_,
+            buffer.fb_handle,
+            0,
+            destination_.x,
+            destination_.y,
+            destination_.width,
+            destination_.height,
+            src.x << 16,
+            src.y << 16,
+            src.width << 16,
+            src.height << 16);
+    }
+    if (result)
     {
         throw std::runtime_error("drmModeSetPlane failed: " + std::string(ERRSTR));
     }
+    framesShown.Increment();
     if (last_fd_ >= 0)
     {
         done_callback_(last_fd_);
@@ -384,21 +517,82 @@ void DrmPreview::Show(int fd, libcamera::Span<uint8_t> span, const StreamInfo& i
     last_fd_ = fd;
 }
 
+bool DrmPreview::EnableOverlay(const libcamera::Rectangle& area)
+{
+    if (overlay_)
+    {
+        return true;
+    }
+
+    const auto planeId = findPlane(DRM_FORMAT_ARGB8888, planeId_);
+    if (!planeId)
+    {
+        std::cerr << "DrmPreview: no spare ARGB8888 plane for the overlay" << std::endl;
+        return false;
+    }
+    // Planes without a zpos property stack in a fixed order, normally with the later
+    // (overlay) ones on top, which is what we want anyway.
+    if (drm_set_property_max(m_drmfd, planeId, "zpos") < 0)
+    {
+        std::cerr << "DrmPreview: could not raise the overlay plane, it may end up under the video" << std::endl;
+    }
+    // The plane and its buffers only cover the part of the video the overlay is for.
+    const auto overlayArea = area.isNull()
+        ? destination_
+        : libcamera::Rectangle(destination_.x + area.x, destination_.y + area.y, area.width, area.height)
+              .boundedTo(destination_);
+    if (overlayArea.isNull())
+    {
+        std::cerr << "DrmPreview: overlay area is outside the video" << std::endl;
+        return false;
+    }
+    overlay_ = std::make_unique<Overlay>(m_drmfd, crtcId_, planeId, overlayArea);
+    return true;
+}
+
+void DrmPreview::SetInfoText(const std::string& text)
+{
+    if (!overlay_)
+    {
+        return;
+    }
+    overlay_->SetText("info", 0, 0, text);
+    overlay_->Commit();
+}
+
+bool DrmPreview::GetVblank(uint64_t& sequence, int64_t& timestampNs) const
+{
+    // A relative wait for zero vblanks returns straight away with the last one.
+    drmVBlank vblank = {};
+    auto type = static_cast<unsigned int>(DRM_VBLANK_RELATIVE);
+    if (crtcIdx_ == 1)
+    {
+        type |= DRM_VBLANK_SECONDARY;
+    }
+    else if (crtcIdx_ > 1)
+    {
+        type |= (crtcIdx_ << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK;
+    }
+    vblank.request.type = static_cast<drmVBlankSeqType>(type);
+    vblank.request.sequence = 0;
+
+    if (drmWaitVBlank(m_drmfd, &vblank))
+    {
+        return false;
+    }
+    sequence = vblank.reply.sequence;
+    timestampNs = vblank.reply.tval_sec * 1000000000LL + vblank.reply.tval_usec * 1000LL;
+    return true;
+}
+
 void DrmPreview::Reset()
 {
     for (auto& it : buffers_)
     {
         drmModeRmFB(m_drmfd, it.second.fb_handle);
-        // Apparently a "bo_handle" is a "gem" thing, and it needs closing. It feels like there
-        // ought be an API to match "drmPrimeFDToHandle" for this, but I can only find an ioctl.
-        drm_gem_close gem_close = {};
-        gem_close.handle = it.second.bo_handle;
-        if (drmIoctl(m_drmfd, DRM_IOCTL_GEM_CLOSE, &gem_close) < 0)
-        {
-            // I have no idea what this would mean, so complain and try to carry on...
-            std::cerr << "DRM_IOCTL_GEM_CLOSE failed" << std::endl;
-        }
+        close_gem_handle(m_drmfd, it.second.bo_handle);
     }
+    resources::previewFramebuffers.Add(-static_cast<int64_t>(buffers_.size()));
     buffers_.clear();
     last_fd_ = -1;
     first_time_ = true;
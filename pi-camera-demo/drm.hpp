@@ -2,11 +2,16 @@
 
 #include <functional>
 #include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <libcamera/base/span.h>
+#include <libcamera/geometry.h>
 #include "stream_info.hpp"
 
+class Overlay;
+
 class DrmPreview
 {
 private:
@@ -21,7 +26,8 @@ private:
 };
 	   void makeBuffer(int fd, size_t size, StreamInfo const& info, Buffer& buffer);
 	   void findCrtc();
-	   void findPlane();
+	   // First plane on our CRTC supporting fourcc, other than exclude; 0 if there is none.
+	   uint32_t findPlane(unsigned int fourcc, uint32_t exclude = 0);
 	   int m_drmfd;
 	   int conId_;
 	   uint32_t crtcId_;
@@ -32,22 +38,31 @@ private:
 	   unsigned int height_;
 	   unsigned int screen_width_;
 	   unsigned int screen_height_;
+	   libcamera::Rectangle destination_;
 	   std::map<int, Buffer> buffers_; // map the DMABUF's fd to the Buffer
 	   int last_fd_;
 	   unsigned int max_image_width_;
 	   unsigned int max_image_height_;
+	   double refresh_rate_;
 	   bool first_time_;
+	   std::unique_ptr<Overlay> overlay_;
 
 
 public:
 	typedef std::function<void(int fd)> DoneCallback;
 
-	DrmPreview();
-	virtual ~DrmPreview() {}
+	// A connector of 0 picks the first enabled one; a null destination goes fullscreen.
+	DrmPreview(int connectorId = 0, libcamera::Rectangle const& destination = {});
+	virtual ~DrmPreview();
 	// This is where the application sets the callback it gets whenever the viewfinder
 	// is no longer displaying the buffer and it can be safely recycled.
 	void SetDoneCallback(DoneCallback callback) { done_callback_ = callback; }
-	virtual void SetInfoText(const std::string& text) {}
+	// Puts an ARGB overlay plane over `area` of the video (relative to its top left
+	// corner, null for all of it), for the text below. Returns false if the display
+	// has no spare plane for it.
+	bool EnableOverlay(libcamera::Rectangle const& area = {});
+	// Text in the top left corner of the overlay; does nothing without an overlay.
+	virtual void SetInfoText(const std::string& text);
 	// Display the buffer. You get given the fd back in the BufferDoneCallback
 	// once its available for re-use.
 
@@ -60,8 +75,10 @@ public:
 
 
 	// Display the buffer. You get given the fd back in the BufferDoneCallback
-// once its available for re-use.
-	void Show(int fd, libcamera::Span<uint8_t> span, StreamInfo const& info);
+// once its available for re-use. A non-null crop selects the part of the buffer
+// to show; it is applied in the same plane update as the buffer itself.
+	void Show(int fd, libcamera::Span<const uint8_t> span, StreamInfo const& info,
+		libcamera::Rectangle const& crop = {});
 	// Reset the preview window, clearing the current buffers and being ready to
 	// show new ones.
 	void Reset();
@@ -71,6 +88,10 @@ public:
 		w = max_image_width_;
 		h = max_image_height_;
 	}
+	// Refresh rate of the CRTC we display on, in Hz.
+	double RefreshRate() const { return refresh_rate_; }
+	// Sequence number and CLOCK_MONOTONIC time of the most recent vblank.
+	bool GetVblank(uint64_t& sequence, int64_t& timestampNs) const;
 
 protected:
 	DoneCallback done_callback_;
@@ -2,7 +2,6 @@
 //
 
 #include "pi-camera-demo.h"
-#include "drm.hpp"
 
 #include <memory>
 #include <libcamera/camera.h>
@@ -18,50 +17,231 @@
 #include <libcamera/libcamera.h>
 #include <linux/videodev2.h>
 #include "spdlog/spdlog.h"
+#include "spdlog/fmt/ranges.h"
 
-#include <memory>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <thread>
 #include "CameraWrapper.hpp"
+#include "FakeSource.hpp"
+#include "MetricsExporter.hpp"
+#include "Pipeline.hpp"
+#include "PipelineConfig.hpp"
+#include "Resources.hpp"
 
-// Default config
-constexpr int WIDTH = 1280;
-constexpr int HEIGHT = 720;
-
-DrmPreview* preview;
+constexpr auto STATS_LOG_INTERVAL = std::chrono::seconds(5);
 
 std::unique_ptr<CameraWrapper> camera;
 
-std::map<int, libcamera::Request*> fdToRequestMap;
+std::unique_ptr<FakeSource> fakeSource;
+
+std::unique_ptr<Pipeline> pipeline;
 
-int main()
+// Frames into the pipeline since capture last started, and how many make it "running".
+std::atomic<unsigned int> framesSinceStart = 0;
+unsigned int framesUntilRunning = 0;
+
+int main(int argc, char* argv[])
 {
-    check_camera_stack();
+    // SIGUSR1 reports an event to the pipeline, SIGUSR2 moves the zoom on to the next
+    // target, SIGHUP tears capture down and sets it up again, SIGINT and SIGTERM shut down. They are
+    // blocked before any thread starts, so that all of them inherit the mask and only
+    // the wait below ever takes them.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGUSR2);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
 
-    preview = new DrmPreview();
-    preview->SetDoneCallback(&DoneCallback);
+    // The pipeline description is optional; without one we run the default preview.
+    PipelineConfig config;
+    try
+    {
+        config = argc > 1 ? PipelineConfig::Load(argv[1]) : PipelineConfig::Default();
+    }
+    catch (const std::exception& e)
+    {
+        spdlog::error("Invalid pipeline config: {}", e.what());
+        return EXIT_FAILURE;
+    }
+    if (!config.source.fake)
+    {
+        check_camera_stack();
+    }
 
-    camera = std::make_unique<CameraWrapper>(WIDTH, HEIGHT);
-    camera->Init(ProcessRequest);
-    camera->StartCapture();
+    std::unique_ptr<MetricsExporter> metricsExporter;
+    if (!config.metricsEndpoint.empty())
+    {
+        try
+        {
+            metricsExporter = std::make_unique<MetricsExporter>(metrics::GetRegistry(), config.metricsEndpoint);
+        }
+        catch (const std::exception& e)
+        {
+            spdlog::error("Failed to serve metrics: {}", e.what());
+            return EXIT_FAILURE;
+        }
+    }
+
+    // The exporter serves for the whole run, so it is up already. Every restart and the
+    // shutdown must bring the process back to this.
+    const auto resourcesAtStart = resources::Report::Take();
+    start_capture(config);
+    unsigned int restarts = 0;
+    bool restartsClean = true;
+
+    auto nextLog = std::chrono::steady_clock::now() + STATS_LOG_INTERVAL;
+    size_t zoomTarget = config.source.zoomTargets.size() - 1;
+    while (true)
+    {
+        const auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(nextLog - std::chrono::steady_clock::now());
+        const timespec timeout = { wait.count() / 1000000000, wait.count() % 1000000000 };
+        const auto signal = wait.count() > 0 ? sigtimedwait(&signals, nullptr, &timeout) : -1;
+        if (signal == SIGINT || signal == SIGTERM)
+        {
+            spdlog::info("Shutting down");
+            break;
+        }
+        if (signal == SIGUSR1)
+        {
+            spdlog::info("Event signalled");
+            pipeline->OnEvent();
+            continue;
+        }
+        if (signal == SIGHUP)
+        {
+            spdlog::info("Restarting capture");
+            stop_capture();
+            restarts++;
+            restartsClean &= resources::LogLeaks(
+                resourcesAtStart, resources::Report::Take(), "restart " + std::to_string(restarts));
+            start_capture(config);
+            continue;
+        }
+        if (signal == SIGUSR2)
+        {
+            if (camera && !config.source.zoomTargets.empty())
+            {
+                zoomTarget = (zoomTarget + 1) % config.source.zoomTargets.size();
+                set_zoom(config.source.zoomTargets[zoomTarget], config.source.zoomRampFrames);
+            }
+            continue;
+        }
+        nextLog += STATS_LOG_INTERVAL;
+        if (!camera)
+        {
+            continue;
+        }
+
+        const auto stats = camera->GetFrameStats();
+        spdlog::info(
+            "Frames: {} dropped: {} duplicated: {} out of order: {} repeated on display: {} jitter: last {}us max {}us "
+            "histogram [{}]",
+            stats.frames,
+            stats.dropped,
+            stats.duplicated,
+            stats.outOfOrder,
+            stats.repeated,
+            stats.lastJitterUs,
+            stats.maxJitterUs,
+            fmt::join(stats.jitterHistogram, " "));
 
-    while(true){}
+        const auto pacing = camera->GetPacingStats();
+        spdlog::info(
+            "Pacing: {} phase error: last {}us rms {:.0f}us judder: {}/{} frames duration {}us",
+            pacing.locked ? "locked" : "unlocked",
+            pacing.lastPhaseErrorUs,
+            pacing.rmsPhaseErrorUs,
+            pacing.juddered,
+            pacing.frames,
+            pacing.frameDurationUs);
 
-	return 0;
+        const auto zoom = camera->GetZoomStats();
+        if (zoom.steps > 0)
+        {
+            spdlog::info(
+                "Zoom: {} steps latency: last {}us ({} frames) max {}us",
+                zoom.steps,
+                zoom.lastLatencyUs,
+                zoom.lastLatencyFrames,
+                zoom.maxLatencyUs);
+        }
+
+        pipeline->SetInfoText(fmt::format(
+            "frames {} dropped {}\njitter max {}us\npacing {} rms {:.0f}us",
+            stats.frames,
+            stats.dropped,
+            stats.maxJitterUs,
+            pacing.locked ? "locked" : "unlocked",
+            pacing.rmsPhaseErrorUs));
+    }
+
+    stop_capture();
+    const auto shutdownClean = resources::LogLeaks(resourcesAtStart, resources::Report::Take());
+    metricsExporter.reset();
+    return shutdownClean && restartsClean ? 0 : EXIT_FAILURE;
 }
 
 void ProcessRequest(CameraWrapper* cameraWrapper, libcamera::Request* request)
 {
-    const auto buffer = request->buffers().at(cameraWrapper->GetVideoStream());
-    const auto& span = cameraWrapper->Mmap(buffer)[0];
-    const auto info = cameraWrapper->GetStreamInfo();
-    const auto fd = buffer->planes()[0].fd.get();
-    fdToRequestMap[fd] = request;
-    preview->Show(fd, span, info);
+    pipeline->Push(request);
+    count_frame();
+}
+
+static void start_capture(const PipelineConfig& config)
+{
+    // Twice round the buffers, so by then each has normally been through the pipeline
+    // and been imported by the preview.
+    framesSinceStart = 0;
+    framesUntilRunning = 2 * config.source.bufferCount;
+
+    if (config.source.fake)
+    {
+        pipeline = std::make_unique<Pipeline>(config, nullptr);
+        fakeSource = std::make_unique<FakeSource>(config.source, [](FramePtr frame) {
+            pipeline->Push(std::move(frame));
+            count_frame();
+        });
+        fakeSource->Start();
+    }
+    else
+    {
+        camera = std::make_unique<CameraWrapper>(config.source);
+        camera->Init(ProcessRequest);
+        pipeline = std::make_unique<Pipeline>(config, camera.get());
+        camera->StartCapture();
+    }
 }
 
+static void stop_capture()
+{
+    // Stop the source first, so nothing new enters the pipeline and frames given back
+    // from here on stay with the source. The pipeline then drains its queues and its
+    // sinks release the frames they hold, and only then can the source free the buffers.
+    if (fakeSource)
+    {
+        fakeSource->Stop();
+    }
+    if (camera)
+    {
+        camera->StopCapture();
+    }
+    pipeline.reset();
+    fakeSource.reset();
+    camera.reset();
+}
 
-void DoneCallback(int fd)
+static void count_frame()
 {
-    camera->ReuseRequest(fdToRequestMap.at(fd));
+    // Logged once per start, for scripts that need to wait until frames are flowing.
+    if (++framesSinceStart == framesUntilRunning)
+    {
+        spdlog::info("Capture running");
+    }
 }
 
 
@@ -85,3 +265,24 @@ static void check_camera_stack()
     spdlog::error("ERROR: the system appears to be configured for the legacy camera stack");
     exit(-1);
 }
+
+static void set_zoom(const ZoomTarget& target, unsigned int rampFrames)
+{
+    try
+    {
+        if (target.region.isNull())
+        {
+            spdlog::info("Zooming to {}x over {} frames", target.factor, rampFrames);
+            camera->SetZoom(target.factor, 0.5, 0.5, rampFrames);
+        }
+        else
+        {
+            spdlog::info("Zooming to {} over {} frames", target.region.toString(), rampFrames);
+            camera->SetRegionOfInterest(target.region, rampFrames);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        spdlog::warn("Zoom: {}", e.what());
+    }
+}
@@ -8,12 +8,16 @@
 #include <libcamera/request.h>
 
 #include "CameraWrapper.hpp"
+#include "PipelineConfig.hpp"
 
 
 // TODO: Reference additional headers your program requires here.
 static void check_camera_stack();
+static void set_zoom(const ZoomTarget& target, unsigned int rampFrames);
+static void start_capture(const PipelineConfig& config);
+static void stop_capture();
+static void count_frame();
 void ProcessRequest(CameraWrapper* cameraWrapper, libcamera::Request* request);
-void DoneCallback(int fd);
 
 struct CompletedRequest
 {
@@ -0,0 +1,241 @@
+// Replays recorded-style sequence and timestamp traces, with injected drops, through
+// FrameMonitor and checks what it counts. Exits non-zero if any check fails.
+
+#include <cstdint>
+#include <cstdio>
+#include <numeric>
+#include <vector>
+
+#include "FrameMonitor.hpp"
+
+#define CHECK_EQ(actual, expected)                                                                      \
+    do                                                                                                  \
+    {                                                                                                   \
+        const auto a = (actual);                                                                        \
+        const auto e = (expected);                                                                      \
+        if (a != e)                                                                                     \
+        {                                                                                               \
+            std::printf("%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual,              \
+                static_cast<long long>(a), static_cast<long long>(e));                                  \
+            failures++;                                                                                 \
+        }                                                                                               \
+    } while (0)
+
+namespace
+{
+    constexpr int64_t FRAME_DURATION_US = 33333;
+
+    int failures = 0;
+
+    struct Sample
+    {
+        uint32_t sequence;
+        // Offset from the ideal timestamp for the sequence number.
+        int64_t offsetUs = 0;
+        int64_t frameDurationUs = 0;
+    };
+
+    // Feeds `trace` through `monitor` and returns the total reported as dropped.
+    uint64_t replay(FrameMonitor& monitor, const std::vector<Sample>& trace)
+    {
+        uint64_t dropped = 0;
+        for (const auto& sample : trace)
+        {
+            const auto timestampNs = (static_cast<int64_t>(sample.sequence) * FRAME_DURATION_US + sample.offsetUs) * 1000;
+            dropped += monitor.OnFrame(sample.sequence, timestampNs, sample.frameDurationUs).dropped;
+        }
+        return dropped;
+    }
+
+    uint64_t histogramTotal(const FrameMonitor::Stats& stats)
+    {
+        return std::accumulate(stats.jitterHistogram.begin(), stats.jitterHistogram.end(), uint64_t(0));
+    }
+
+    void testCleanTrace()
+    {
+        FrameMonitor monitor;
+        monitor.SetFrameDuration(FRAME_DURATION_US);
+        std::vector<Sample> trace;
+        for (uint32_t sequence = 0; sequence < 100; sequence++)
+        {
+            trace.push_back({ sequence });
+        }
+        CHECK_EQ(replay(monitor, trace), 0u);
+
+        const auto stats = monitor.GetStats();
+        CHECK_EQ(stats.frames, 100u);
+        CHECK_EQ(stats.dropped, 0u);
+        CHECK_EQ(stats.duplicated, 0u);
+        CHECK_EQ(stats.outOfOrder, 0u);
+        CHECK_EQ(stats.maxJitterUs, 0);
+        CHECK_EQ(stats.jitterHistogram[0], 99u);
+        CHECK_EQ(histogramTotal(stats), 99u);
+    }
+
+    void testInjectedDrops()
+    {
+        FrameMonitor monitor;
+        monitor.SetFrameDuration(FRAME_DURATION_US);
+        CHECK_EQ(replay(monitor, { { 10 }, { 11 }, { 12 } }), 0u);
+        // One frame missing, then three.
+        CHECK_EQ(replay(monitor, { { 14 } }), 1u);
+        CHECK_EQ(replay(monitor, { { 15 }, { 19 }, { 20 } }), 3u);
+
+        const auto stats = monitor.GetStats();
+        CHECK_EQ(stats.frames, 7u);
+        CHECK_EQ(stats.dropped, 4u);
+        // Intervals spanning the drops are measured against the skipped frames' spacing,
+        // so they don't count as jitter too.
+        CHECK_EQ(stats.maxJitterUs, 0);
+        CHECK_EQ(stats.jitterHistogram[0], 6u);
+    }
+
+    void testDuplicatedAndOutOfOrder()
+    {
+        FrameMonitor monitor;
+        monitor.SetFrameDuration(FRAME_DURATION_US);
+        CHECK_EQ(replay(monitor, { { 0 }, { 1 }, { 1 }, { 2 }, { 4 }, { 3 }, { 5 } }), 1u);
+
+        const auto stats = monitor.GetStats();
+        CHECK_EQ(stats.frames, 7u);
+        CHECK_EQ(stats.duplicated, 1u);
+        CHECK_EQ(stats.outOfOrder, 1u);
+        CHECK_EQ(stats.dropped, 1u);
+        CHECK_EQ(histogramTotal(stats), 4u);
+
+        // Each frame's result says what it was, for the counters exported per frame.
+        FrameMonitor single;
+        single.SetFrameDuration(FRAME_DURATION_US);
+        single.OnFrame(0, 0);
+        const auto duplicate = single.OnFrame(0, 0);
+        CHECK_EQ(duplicate.duplicated, true);
+        CHECK_EQ(duplicate.outOfOrder, false);
+        single.OnFrame(2, 2 * FRAME_DURATION_US * 1000);
+        const auto late = single.OnFrame(1, FRAME_DURATION_US * 1000);
+        CHECK_EQ(late.outOfOrder, true);
+        CHECK_EQ(late.duplicated, false);
+        CHECK_EQ(late.dropped, 0u);
+    }
+
+    void testSequenceWrap()
+    {
+        FrameMonitor monitor;
+        monitor.SetFrameDuration(FRAME_DURATION_US);
+        CHECK_EQ(monitor.OnFrame(0xfffffffe, 0, 0).dropped, 0u);
+        CHECK_EQ(monitor.OnFrame(0xffffffff, FRAME_DURATION_US * 1000, 0).dropped, 0u);
+        CHECK_EQ(monitor.OnFrame(1, 3 * FRAME_DURATION_US * 1000, 0).dropped, 1u);
+        const auto stats = monitor.GetStats();
+        CHECK_EQ(stats.dropped, 1u);
+        CHECK_EQ(stats.outOfOrder, 0u);
+    }
+
+    void testJitterHistogram()
+    {
+        FrameMonitor monitor;
+        monitor.SetFrameDuration(FRAME_DURATION_US);
+        // Each offset is relative to the ideal time, so the intervals come out at
+        // +60us, -360us, +300us and +6000us from the frame duration.
+        CHECK_EQ(replay(monitor, { { 0 }, { 1, 60 }, { 2, -300 }, { 3 }, { 4, 6000 } }), 0u);
+
+        const auto stats = monitor.GetStats();
+        CHECK_EQ(stats.lastJitterUs, 6000);
+        CHECK_EQ(stats.maxJitterUs, 6000);
+        CHECK_EQ(stats.jitterHistogram[1], 1u);
+        CHECK_EQ(stats.jitterHistogram[3], 2u);
+        CHECK_EQ(stats.jitterHistogram[FrameMonitor::JITTER_BIN_COUNT - 1], 1u);
+        CHECK_EQ(histogramTotal(stats), 4u);
+    }
+
+    void testRollingWindow()
+    {
+        FrameMonitor monitor(4);
+        monitor.SetFrameDuration(FRAME_DURATION_US);
+        // The +3000us interval and the -3000us one after it fall out of the window of the
+        // last four intervals, though the maximum remembers them.
+        CHECK_EQ(replay(monitor, { { 0 }, { 1, 3000 }, { 2 }, { 3 }, { 4 }, { 5 }, { 6 } }), 0u);
+
+        const auto stats = monitor.GetStats();
+        CHECK_EQ(stats.maxJitterUs, 3000);
+        CHECK_EQ(stats.jitterHistogram[0], 4u);
+        CHECK_EQ(histogramTotal(stats), 4u);
+    }
+
+    void testReportedFrameDurations()
+    {
+        FrameMonitor monitor;
+        monitor.SetFrameDuration(FRAME_DURATION_US);
+        // The frame durations move by a few hundred microseconds, as they do while pacing,
+        // and each interval matches the duration reported by the frame that starts it.
+        const std::vector<int64_t> durations = { 33333, 33000, 33666, 33500, 33333 };
+        int64_t timestampNs = 0;
+        for (uint32_t sequence = 0; sequence < durations.size(); sequence++)
+        {
+            CHECK_EQ(monitor.OnFrame(sequence, timestampNs, durations[sequence]).dropped, 0u);
+            timestampNs += durations[sequence] * 1000;
+        }
+
+        const auto stats = monitor.GetStats();
+        CHECK_EQ(stats.maxJitterUs, 0);
+        CHECK_EQ(stats.jitterHistogram[0], 4u);
+    }
+
+    void testDisplayRepeats()
+    {
+        FrameMonitor monitor;
+        // One refresh per frame: the gap after vblank 101 means frame 101 stayed up twice.
+        CHECK_EQ(monitor.OnDisplayed(100, 1), 0u);
+        CHECK_EQ(monitor.OnDisplayed(101, 1), 0u);
+        CHECK_EQ(monitor.OnDisplayed(103, 1), 1u);
+        CHECK_EQ(monitor.OnDisplayed(104, 1), 0u);
+        CHECK_EQ(monitor.GetStats().repeated, 1u);
+
+        // Two refreshes per frame, with one frame held for four refreshes.
+        monitor.Reset();
+        CHECK_EQ(monitor.OnDisplayed(10, 2), 0u);
+        CHECK_EQ(monitor.OnDisplayed(12, 2), 0u);
+        CHECK_EQ(monitor.OnDisplayed(16, 2), 2u);
+        CHECK_EQ(monitor.OnDisplayed(18, 2), 0u);
+        CHECK_EQ(monitor.GetStats().repeated, 2u);
+    }
+
+    void testReset()
+    {
+        FrameMonitor monitor;
+        monitor.SetFrameDuration(FRAME_DURATION_US);
+        replay(monitor, { { 0 }, { 3, 500 } });
+        monitor.Reset();
+        // After a reset the next frame starts a new trace rather than being compared
+        // with the last one before it.
+        CHECK_EQ(replay(monitor, { { 1 }, { 2 } }), 0u);
+
+        const auto stats = monitor.GetStats();
+        CHECK_EQ(stats.frames, 2u);
+        CHECK_EQ(stats.dropped, 0u);
+        CHECK_EQ(stats.outOfOrder, 0u);
+        CHECK_EQ(stats.maxJitterUs, 0);
+        CHECK_EQ(stats.frameDurationUs, FRAME_DURATION_US);
+        CHECK_EQ(histogramTotal(stats), 1u);
+    }
+}
+
+int main()
+{
+    testCleanTrace();
+    testInjectedDrops();
+    testDuplicatedAndOutOfOrder();
+    testSequenceWrap();
+    testJitterHistogram();
+    testRollingWindow();
+    testReportedFrameDurations();
+    testDisplayRepeats();
+    testReset();
+
+    if (failures)
+    {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,229 @@
+// Closes FramePacer's loop around a simulated sensor and display: the sensor's clock
+// drifts from the display's, a requested frame duration takes effect a few frames
+// later as it does through the camera pipeline, and each frame is latched by the first
+// vblank after it arrives. Checks how soon the loop locks, where it settles and that
+// its corrections stay within their bounds. Exits non-zero if any check fails.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+
+#include "FramePacer.hpp"
+
+#define CHECK(condition)                                                                                \
+    do                                                                                                  \
+    {                                                                                                   \
+        if (!(condition))                                                                               \
+        {                                                                                               \
+            std::printf("%s:%d: %s failed\n", __FILE__, __LINE__, #condition);                          \
+            failures++;                                                                                 \
+        }                                                                                               \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                                                      \
+    do                                                                                                  \
+    {                                                                                                   \
+        const auto a = (actual);                                                                        \
+        const auto e = (expected);                                                                      \
+        if (a != e)                                                                                     \
+        {                                                                                               \
+            std::printf("%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual,              \
+                static_cast<long long>(a), static_cast<long long>(e));                                  \
+            failures++;                                                                                 \
+        }                                                                                               \
+    } while (0)
+
+namespace
+{
+    constexpr double REFRESH_HZ = 60;
+    constexpr int64_t PERIOD_NS = 16'666'667;
+    // From the start of a frame to it being ready for the display: readout, ISP and
+    // the pipeline's queues.
+    constexpr int64_t LATENCY_NS = 21'300'000;
+    constexpr int64_t TARGET_MARGIN_NS = 2'000'000;
+    // Frames at the end of a run over which to judge where the loop settled.
+    constexpr int FINAL_FRAMES = 30;
+    // How close to the target it must settle by then.
+    constexpr int64_t SETTLED_ERROR_US = 50;
+
+    int failures = 0;
+
+    struct Result
+    {
+        // Frame on which the pacer first reported lock, or -1.
+        int lockedAt = -1;
+        bool lockedAtEnd = false;
+        // Worst phase error and how far ahead of its vblank frames arrived, over the
+        // last FINAL_FRAMES frames.
+        int64_t finalMaxErrorUs = 0;
+        int64_t finalMarginMinNs = 0;
+        int64_t finalMarginMaxNs = 0;
+        int64_t minDurationUs = INT64_MAX;
+        int64_t maxDurationUs = 0;
+        // Frames juddered after lock.
+        uint64_t judderedAfterLock = 0;
+    };
+
+    // Runs `frames` frames through a pacer for a 60Hz display, with the sensor's frames
+    // lasting `driftPpm` longer than requested, its first frame starting `startPhaseNs` into a refresh period and
+    // each requested duration applying `lag` frames later.
+    Result simulate(double driftPpm, unsigned int lag, int64_t startPhaseNs, int frames = 600, bool control = true)
+    {
+        FramePacer pacer;
+        const auto nominalUs = pacer.Configure(REFRESH_HZ, 60, 0, control);
+        std::deque<int64_t> requestedUs(lag, nominalUs);
+
+        Result result;
+        uint64_t juddered = 0;
+        auto frameStartNs = startPhaseNs;
+        result.finalMarginMinNs = INT64_MAX;
+        result.finalMarginMaxNs = INT64_MIN;
+        for (int frame = 0; frame < frames; frame++)
+        {
+            const auto arrivalNs = frameStartNs + LATENCY_NS;
+            const auto latchSequence = static_cast<uint64_t>(arrivalNs / PERIOD_NS + 1);
+            const auto latchNs = static_cast<int64_t>(latchSequence) * PERIOD_NS;
+            pacer.OnDisplayed(arrivalNs, latchSequence, latchNs);
+
+            const auto stats = pacer.GetStats();
+            if (stats.locked && result.lockedAt < 0)
+            {
+                result.lockedAt = frame;
+                juddered = stats.juddered;
+            }
+            if (frame >= frames - FINAL_FRAMES)
+            {
+                result.finalMaxErrorUs = std::max(result.finalMaxErrorUs, std::abs(stats.lastPhaseErrorUs));
+                result.finalMarginMinNs = std::min(result.finalMarginMinNs, latchNs - arrivalNs);
+                result.finalMarginMaxNs = std::max(result.finalMarginMaxNs, latchNs - arrivalNs);
+            }
+            result.lockedAtEnd = stats.locked;
+            result.judderedAfterLock = result.lockedAt < 0 ? 0 : stats.juddered - juddered;
+
+            // The duration asked for now is the one the sensor uses `lag` frames on, and
+            // the sensor's clock runs off the display's by the drift.
+            const auto durationUs = pacer.FrameDurationUs();
+            result.minDurationUs = std::min(result.minDurationUs, durationUs);
+            result.maxDurationUs = std::max(result.maxDurationUs, durationUs);
+            requestedUs.push_back(durationUs);
+            frameStartNs += std::llround(requestedUs.front() * 1000 * (1 + driftPpm * 1e-6));
+            requestedUs.pop_front();
+        }
+        return result;
+    }
+
+    void testConfigure()
+    {
+        FramePacer pacer;
+        // As fast as the display allows, then limited by the requested frame rate and by
+        // the sensor's shortest frame.
+        CHECK_EQ(pacer.Configure(60, 60, 0, true), PERIOD_NS / 1000);
+        CHECK_EQ(pacer.GetStats().refreshesPerFrame, 1u);
+        CHECK_EQ(pacer.Configure(60, 30, 0, true), 2 * PERIOD_NS / 1000);
+        CHECK_EQ(pacer.GetStats().refreshesPerFrame, 2u);
+        CHECK_EQ(pacer.Configure(60, 60, 20'000, true), 2 * PERIOD_NS / 1000);
+        CHECK_EQ(pacer.Configure(50, 60, 0, true), 20'000);
+    }
+
+    void testLocksUnderDrift()
+    {
+        // Clock drift of a few hundred ppm either way, a pipeline two to five frames
+        // deep and any starting phase.
+        for (const auto driftPpm : { -300.0, 0.0, 300.0 })
+        {
+            for (const auto lag : { 2u, 5u })
+            {
+                for (const auto startPhaseNs : { int64_t(0), int64_t(5'000'000), int64_t(12'000'000) })
+                {
+                    const auto result = simulate(driftPpm, lag, startPhaseNs);
+                    const auto where = [&] {
+                        std::printf("  at %+.0fppm, %u frames of lag, starting %lldns into the period\n",
+                            driftPpm, lag, static_cast<long long>(startPhaseNs));
+                    };
+                    const auto before = failures;
+                    // Locks within five seconds, which takes 30 frames in a row within
+                    // the lock threshold, and stays locked.
+                    CHECK(result.lockedAt >= 0 && result.lockedAt < 300);
+                    CHECK(result.lockedAtEnd);
+                    CHECK(result.finalMaxErrorUs < SETTLED_ERROR_US);
+                    // Frames settle the target margin ahead of the vblank latching them,
+                    // every one for exactly one refresh.
+                    CHECK(std::abs(result.finalMarginMinNs - TARGET_MARGIN_NS) < SETTLED_ERROR_US * 1000);
+                    CHECK(std::abs(result.finalMarginMaxNs - TARGET_MARGIN_NS) < SETTLED_ERROR_US * 1000);
+                    CHECK_EQ(result.judderedAfterLock, 0u);
+                    if (failures != before)
+                    {
+                        where();
+                    }
+                }
+            }
+        }
+    }
+
+    void testCorrectionIsBounded()
+    {
+        // Drift far beyond what the loop may correct: the durations stay within 2% of
+        // nominal and it never claims lock.
+        for (const auto driftPpm : { -50'000.0, 50'000.0 })
+        {
+            // Durations are requested in whole microseconds, so allow for truncation.
+            const auto result = simulate(driftPpm, 3, 0);
+            const auto minNs = 0.98 * PERIOD_NS - 1000;
+            const auto maxNs = 1.02 * PERIOD_NS;
+            CHECK(result.minDurationUs * 1000 >= minNs);
+            CHECK(result.maxDurationUs * 1000 <= maxNs);
+            // And the loop does push against the bound in the direction of the drift.
+            CHECK(driftPpm > 0 ? result.minDurationUs * 1000 < minNs + 2000 : result.maxDurationUs * 1000 > maxNs - 2000);
+            CHECK(result.lockedAt < 0);
+        }
+    }
+
+    void testMeasureOnly()
+    {
+        // Without control the duration never moves and, with the phase starting off
+        // target, it never locks either.
+        const auto result = simulate(0, 3, 5'000'000, 600, false);
+        CHECK_EQ(result.minDurationUs, PERIOD_NS / 1000);
+        CHECK_EQ(result.maxDurationUs, PERIOD_NS / 1000);
+        CHECK(result.lockedAt < 0);
+    }
+
+    void testReset()
+    {
+        FramePacer pacer;
+        pacer.Configure(REFRESH_HZ, 60, 0, true);
+        for (int frame = 0; frame < 10; frame++)
+        {
+            const auto arrivalNs = frame * PERIOD_NS + 8'000'000;
+            pacer.OnDisplayed(arrivalNs, frame + 1, (frame + 1) * PERIOD_NS);
+        }
+        CHECK(pacer.FrameDurationUs() != PERIOD_NS / 1000);
+
+        // Back to the nominal duration with fresh statistics, keeping the configuration.
+        pacer.Reset();
+        const auto stats = pacer.GetStats();
+        CHECK_EQ(pacer.FrameDurationUs(), PERIOD_NS / 1000);
+        CHECK_EQ(stats.frames, 0u);
+        CHECK_EQ(stats.refreshesPerFrame, 1u);
+        CHECK_EQ(stats.displayPeriodNs, PERIOD_NS);
+    }
+}
+
+int main()
+{
+    testConfigure();
+    testLocksUnderDrift();
+    testCorrectionIsBounded();
+    testMeasureOnly();
+    testReset();
+
+    if (failures)
+    {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("All checks passed\n");
+    return 0;
+}
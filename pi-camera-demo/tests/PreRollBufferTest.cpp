@@ -0,0 +1,237 @@
+// Appends synthetic frames, raw and grouped behind keyframes as an encoder would produce
+// them, to small PreRollBuffers and checks what is kept, evicted and flushed. Exits
+// non-zero if any check fails.
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "PreRollBuffer.hpp"
+
+#define CHECK_EQ(actual, expected)                                                                      \
+    do                                                                                                  \
+    {                                                                                                   \
+        const auto a = (actual);                                                                        \
+        const auto e = (expected);                                                                      \
+        if (a != e)                                                                                     \
+        {                                                                                               \
+            std::printf("%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual,              \
+                static_cast<long long>(a), static_cast<long long>(e));                                  \
+            failures++;                                                                                 \
+        }                                                                                               \
+    } while (0)
+
+namespace
+{
+    constexpr int64_t MS = 1'000'000;
+    // Longer than any trace here, so only the arena size limits what is held.
+    constexpr int64_t NO_WINDOW = 1'000'000 * MS;
+
+    int failures = 0;
+
+    // Appends a frame of `size` bytes, each holding `tag`, split in two parts as the
+    // planes of a frame are.
+    bool append(PreRollBuffer& buffer, int64_t timestampNs, bool keyframe, size_t size, uint8_t tag)
+    {
+        const std::vector<uint8_t> data(size, tag);
+        const std::span<const uint8_t> parts[] = { { data.data(), size / 2 }, { data.data() + size / 2, size - size / 2 } };
+        return buffer.Append(timestampNs, keyframe, parts);
+    }
+
+    struct Flushed
+    {
+        int64_t timestampNs;
+        bool keyframe;
+        size_t size;
+        uint8_t tag;
+        // Whether every byte of the record holds its tag.
+        bool intact;
+    };
+
+    std::vector<Flushed> flush(PreRollBuffer& buffer)
+    {
+        std::vector<Flushed> flushed;
+        const auto count = buffer.Flush([&](const std::vector<PreRollBuffer::Record>& records) {
+            for (const auto& record : records)
+            {
+                bool intact = true;
+                for (const auto byte : record.data)
+                {
+                    intact &= byte == record.data.front();
+                }
+                flushed.push_back({ record.timestampNs, record.keyframe, record.data.size(), record.data.front(), intact });
+            }
+        });
+        CHECK_EQ(count, flushed.size());
+        return flushed;
+    }
+
+    void testWrapAtEndOfArena()
+    {
+        PreRollBuffer buffer(100, NO_WINDOW);
+        // Three raw frames leave 10 bytes at the end, too few for the fourth, which goes
+        // back to the start once the oldest frame has made room there.
+        for (uint8_t i = 0; i < 4; i++)
+        {
+            CHECK_EQ(append(buffer, i * 10 * MS, true, 30, i), true);
+        }
+
+        auto stats = buffer.GetStats();
+        CHECK_EQ(stats.frames, 3u);
+        CHECK_EQ(stats.usedBytes, 90u);
+        CHECK_EQ(stats.evicted, 1u);
+        CHECK_EQ(stats.heldNs, 20 * MS);
+
+        // The next frame fits in the gap between the wrapped one and the oldest.
+        CHECK_EQ(append(buffer, 40 * MS, true, 10, 4), true);
+        // And this one needs the two oldest gone, since the gap at the end stays unused.
+        CHECK_EQ(append(buffer, 50 * MS, true, 50, 5), true);
+
+        stats = buffer.GetStats();
+        CHECK_EQ(stats.frames, 3u);
+        CHECK_EQ(stats.usedBytes, 90u);
+        CHECK_EQ(stats.evicted, 3u);
+
+        const auto flushed = flush(buffer);
+        CHECK_EQ(flushed.size(), 3u);
+        const uint8_t tags[] = { 3, 4, 5 };
+        for (size_t i = 0; i < flushed.size() && i < 3; i++)
+        {
+            CHECK_EQ(flushed[i].tag, tags[i]);
+            CHECK_EQ(flushed[i].timestampNs, tags[i] * 10 * MS);
+            CHECK_EQ(flushed[i].intact, true);
+        }
+    }
+
+    void testEvictWholeGroup()
+    {
+        PreRollBuffer buffer(100, NO_WINDOW);
+        // Two groups fill the arena: a keyframe with two P-frames, then one with one.
+        CHECK_EQ(append(buffer, 0, true, 20, 0), true);
+        CHECK_EQ(append(buffer, 10 * MS, false, 20, 1), true);
+        CHECK_EQ(append(buffer, 20 * MS, false, 20, 2), true);
+        CHECK_EQ(append(buffer, 30 * MS, true, 20, 3), true);
+        CHECK_EQ(append(buffer, 40 * MS, false, 20, 4), true);
+
+        // Making room for one more frame takes the whole first group, not just its
+        // keyframe, so what is held still starts with a keyframe.
+        CHECK_EQ(append(buffer, 50 * MS, false, 20, 5), true);
+
+        const auto stats = buffer.GetStats();
+        CHECK_EQ(stats.frames, 3u);
+        CHECK_EQ(stats.usedBytes, 60u);
+        CHECK_EQ(stats.evicted, 3u);
+        CHECK_EQ(stats.rejected, 0u);
+
+        const auto flushed = flush(buffer);
+        CHECK_EQ(flushed.size(), 3u);
+        if (flushed.size() == 3)
+        {
+            CHECK_EQ(flushed[0].tag, 3);
+            CHECK_EQ(flushed[0].keyframe, true);
+            CHECK_EQ(flushed[1].keyframe, false);
+            CHECK_EQ(flushed[2].tag, 5);
+        }
+    }
+
+    void testRejectLeadingNonKeyframes()
+    {
+        PreRollBuffer buffer(100, NO_WINDOW);
+        // Nothing to append a P-frame to until a keyframe has arrived.
+        CHECK_EQ(append(buffer, 0, false, 20, 0), false);
+        CHECK_EQ(append(buffer, 10 * MS, true, 50, 1), true);
+        CHECK_EQ(append(buffer, 20 * MS, false, 40, 2), true);
+        // No room for this one but where its own group is, so the group goes and the
+        // frame with it, as do the P-frames after it, up to the next keyframe.
+        CHECK_EQ(append(buffer, 30 * MS, false, 30, 3), false);
+        CHECK_EQ(append(buffer, 40 * MS, false, 10, 4), false);
+        // Frames larger than the arena, and empty ones, are never kept.
+        CHECK_EQ(append(buffer, 50 * MS, true, 101, 5), false);
+        CHECK_EQ(append(buffer, 50 * MS, true, 0, 5), false);
+        CHECK_EQ(append(buffer, 60 * MS, true, 30, 6), true);
+
+        const auto stats = buffer.GetStats();
+        CHECK_EQ(stats.rejected, 5u);
+        CHECK_EQ(stats.evicted, 2u);
+        CHECK_EQ(stats.frames, 1u);
+        CHECK_EQ(stats.usedBytes, 30u);
+    }
+
+    void testTrimToWindow()
+    {
+        PreRollBuffer buffer(1000, 100 * MS);
+        // A keyframe every 50ms with a P-frame between. The oldest group goes as soon as
+        // the next one reaches back a full window from the newest frame, and not before.
+        for (uint8_t i = 0; i < 6; i++)
+        {
+            CHECK_EQ(append(buffer, i * 25 * MS, i % 2 == 0, 10, i), true);
+        }
+        auto stats = buffer.GetStats();
+        CHECK_EQ(stats.frames, 6u);
+        CHECK_EQ(stats.evicted, 0u);
+
+        CHECK_EQ(append(buffer, 150 * MS, true, 10, 6), true);
+        stats = buffer.GetStats();
+        CHECK_EQ(stats.frames, 5u);
+        CHECK_EQ(stats.evicted, 2u);
+        CHECK_EQ(stats.heldNs, 100 * MS);
+
+        // After a long gap only the group before it is still needed to cover the window.
+        CHECK_EQ(append(buffer, 1000 * MS, true, 10, 7), true);
+        stats = buffer.GetStats();
+        CHECK_EQ(stats.frames, 2u);
+        CHECK_EQ(stats.evicted, 6u);
+        CHECK_EQ(stats.heldNs, 850 * MS);
+    }
+
+    void testFlushOrder()
+    {
+        PreRollBuffer buffer(100, NO_WINDOW);
+        // Enough raw frames of varying size to go round the ring a few times.
+        int64_t timestampNs = 0;
+        for (uint8_t i = 0; i < 20; i++)
+        {
+            CHECK_EQ(append(buffer, timestampNs, true, 15 + (i % 3) * 10, i), true);
+            timestampNs += 10 * MS;
+        }
+
+        const auto held = buffer.GetStats().frames;
+        const auto flushed = flush(buffer);
+        CHECK_EQ(flushed.size(), held);
+        for (size_t i = 0; i < flushed.size(); i++)
+        {
+            // The newest frames, oldest first, each as it went in.
+            const auto tag = static_cast<uint8_t>(20 - flushed.size() + i);
+            CHECK_EQ(flushed[i].tag, tag);
+            CHECK_EQ(flushed[i].timestampNs, tag * 10 * MS);
+            CHECK_EQ(flushed[i].size, 15u + (tag % 3) * 10);
+            CHECK_EQ(flushed[i].intact, true);
+        }
+
+        // A flush empties the buffer, and appending starts over.
+        auto stats = buffer.GetStats();
+        CHECK_EQ(stats.frames, 0u);
+        CHECK_EQ(stats.usedBytes, 0u);
+        CHECK_EQ(stats.flushes, 1u);
+        CHECK_EQ(flush(buffer).size(), 0u);
+        CHECK_EQ(append(buffer, timestampNs, true, 100, 20), true);
+        CHECK_EQ(buffer.GetStats().usedBytes, 100u);
+    }
+}
+
+int main()
+{
+    testWrapAtEndOfArena();
+    testEvictWholeGroup();
+    testRejectLeadingNonKeyframes();
+    testTrimToWindow();
+    testFlushOrder();
+
+    if (failures)
+    {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("All checks passed\n");
+    return 0;
+}
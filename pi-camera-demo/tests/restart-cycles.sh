@@ -0,0 +1,59 @@
+#!/bin/sh
+# Tears capture down and sets it up again repeatedly in one process, by SIGHUP, and
+# checks from the resource reports in the log and the exit status that every restart and
+# the final shutdown gave back everything capture took.
+#
+#   restart-cycles.sh <pi-camera-demo> <pipeline config> [cycles]
+#
+# Run it with a camera config on a Pi to cover the camera and display as well.
+
+binary=$1
+config=$2
+cycles=${3:-5}
+# Seconds to wait for each line of the log before giving up.
+timeout=${RESTART_TIMEOUT:-30}
+log=$(mktemp)
+trap 'rm -f "$log"' EXIT
+
+fail()
+{
+    kill -KILL "$pid" 2>/dev/null
+    cat "$log"
+    echo "FAILED: $1"
+    exit 1
+}
+
+# Waits until the log holds `count` lines matching `pattern`.
+wait_for()
+{
+    pattern=$1
+    count=$2
+    ticks=0
+    while [ "$(grep -c "$pattern" "$log")" -lt "$count" ]; do
+        kill -0 "$pid" 2>/dev/null || fail "exited while waiting for \"$pattern\" #$count"
+        [ "$ticks" -lt "$((timeout * 10))" ] || fail "timed out waiting for \"$pattern\" #$count"
+        sleep 0.1
+        ticks=$((ticks + 1))
+    done
+}
+
+"$binary" "$config" >"$log" 2>&1 &
+pid=$!
+
+i=1
+while [ "$i" -le "$cycles" ]; do
+    wait_for "Capture running" "$i"
+    kill -HUP "$pid"
+    wait_for "Resources after restart $i:" 1
+    i=$((i + 1))
+done
+wait_for "Capture running" "$i"
+kill -INT "$pid"
+wait "$pid"
+status=$?
+
+[ "$status" -eq 0 ] || fail "exit status $status"
+! grep -q "Resources were leaked" "$log" || fail "resources leaked"
+grep -q "Resources after shutdown" "$log" || fail "no shutdown report"
+cat "$log"
+echo "$cycles restarts clean"